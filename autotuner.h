@@ -0,0 +1,447 @@
+#ifndef AUTOTUNER_H
+#define AUTOTUNER_H
+
+#include "binary.h"
+#include "division_algorithms.h"
+#include "netlist.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const unsigned int TUNE_SAMPLES = 64;      // Operand pairs per configuration
+static const unsigned int TUNE_CACHE_VERSION = 3; // Bump when costs or sampling change
+
+
+/**
+ * MultiplierStyle
+ * @desc Multiplier the cost model charges for
+ */
+enum MultiplierStyle {
+  MUL_TREE,                     // Tree of carry-propagate adders, as mul() simulates
+  MUL_ARRAY                     // Carry-save array with one final carry-propagate add
+};
+
+/**
+ * CostSource
+ * @desc Where the delay of each operation comes from
+ */
+enum CostSource {
+  COST_FORMULA,
+  COST_MEASURED                 // Simulated netlists, see netlist.h
+};
+
+/**
+ * TuneConfig
+ * @desc One point in the divider design space
+ */
+struct TuneConfig {
+  Algorithm algorithm;          // MULTIPLICATIVE_DIVISION or DIVISOR_RECIPROCATION
+  unsigned int width;           // Operand width
+  unsigned int iterlimit;
+  unsigned int seed_bits;       // Reciprocal seed table has 2^seed_bits entries (0 for none)
+  MultiplierStyle style;
+  CostSource source;
+};
+
+/**
+ * TuneResult
+ * @desc Cost and error of a configuration over the sampled operands
+ */
+struct TuneResult {
+  TuneConfig config;
+  unsigned int worst_cost;
+  double mean_cost;
+  double worst_error;           // Absolute error of the quotient
+  double mean_error;
+};
+
+/**
+ * TuneSpace
+ * @desc Values searched along each dimension
+ */
+struct TuneSpace {
+  vector<Algorithm> algorithms;
+  vector<unsigned int> widths;
+  vector<unsigned int> iterlimits;
+  vector<unsigned int> seed_bits;
+  vector<MultiplierStyle> styles;
+  vector<CostSource> sources;
+};
+
+/*
+ * The space searched by the driver
+ */
+TuneSpace default_tune_space() {
+  TuneSpace space;
+  space.algorithms.push_back(MULTIPLICATIVE_DIVISION);
+  space.algorithms.push_back(DIVISOR_RECIPROCATION);
+  unsigned int widths[] = {8, 12, 16, 24};
+  space.widths.assign(widths, widths + 4);
+  for(unsigned int i = 1; i <= 6; i++) {
+    space.iterlimits.push_back(i);
+  }
+  unsigned int seeds[] = {0, 3, 6};
+  space.seed_bits.assign(seeds, seeds + 3);
+  space.styles.push_back(MUL_TREE);
+  space.styles.push_back(MUL_ARRAY);
+  space.sources.push_back(COST_FORMULA);
+  space.sources.push_back(COST_MEASURED);
+  return space;
+}
+
+/*
+ * Every combination of the space's values
+ */
+vector<TuneConfig> enumerate_configs(const TuneSpace& space) {
+  vector<TuneConfig> ret;
+  TuneConfig config;
+  for(unsigned int a = 0; a < space.algorithms.size(); a++)
+    for(unsigned int w = 0; w < space.widths.size(); w++)
+      for(unsigned int i = 0; i < space.iterlimits.size(); i++)
+        for(unsigned int s = 0; s < space.seed_bits.size(); s++)
+          for(unsigned int m = 0; m < space.styles.size(); m++)
+            for(unsigned int c = 0; c < space.sources.size(); c++) {
+              config.algorithm = space.algorithms[a];
+              config.width = space.widths[w];
+              config.iterlimit = space.iterlimits[i];
+              config.seed_bits = space.seed_bits[s];
+              config.style = space.styles[m];
+              config.source = space.sources[c];
+              ret.push_back(config);
+            }
+  return ret;
+}
+
+/*
+ * Writes a configuration's fields, as used in the cache and the report
+ */
+ostream& operator <<(ostream& os, const TuneConfig& config) {
+  return os << (config.algorithm == MULTIPLICATIVE_DIVISION ? "md" : "dr")
+            << " w" << config.width << " i" << config.iterlimit << " t" << config.seed_bits
+            << " " << (config.style == MUL_TREE ? "tree" : "array")
+            << " " << (config.source == COST_FORMULA ? "formula" : "measured");
+}
+
+/*
+ * Cache key: the configuration plus everything else its result depends on
+ */
+string tune_key(const TuneConfig& config, unsigned int samples, unsigned long seed) {
+  stringstream key;
+  key << "v" << TUNE_CACHE_VERSION << " " << config << " n" << samples << " s" << seed;
+  return key.str();
+}
+
+
+/**
+ * seed_entry()
+ * @desc Entry of a reciprocal seed table for divisors in [0.5, 1). Entry j
+ *       covers [lo, hi) and holds 1/hi rounded down, so a divisor scaled by
+ *       it stays below 1.
+ * @param seed_bits [in] the table has 2^seed_bits entries
+ * @param index [in] entry number, the divisor's top seed_bits fraction bits after the leading 1
+ * @param width [in] operand width
+ * @return the entry, with one integer bit
+ */
+Binary seed_entry(unsigned int seed_bits, unsigned int index, unsigned int width) {
+  double hi = 0.5 + (index + 1) * pow(2, -static_cast<int>(seed_bits) - 1);
+  double scaled = floor(pow(2, width - 1) / hi);
+
+  Binary ret(width);
+  for(unsigned int i = 0; i < width; i++) {
+    ret.set_digit(i, fmod(floor(scaled / pow(2, i)), 2) != 0);
+  }
+  ret.set_decimal(width - 1);
+  return ret;
+}
+
+/**
+ * prescale()
+ * @desc Scales dividend and divisor by the divisor's seed so the divisor
+ *       starts within 2^-seed_bits of 1. The dividend is also halved so it
+ *       stays below 1, which the quotient makes up for afterwards.
+ * @param a [in/out] Dividend, a fraction below 1 with one integer bit
+ * @param b [in/out] Divisor in [0.5, 1)
+ * @param seed_bits [in] index width of the seed table
+ * @param cost [in/out] table decode plus the two multiplications in parallel
+ */
+void prescale(Binary& a, Binary& b, unsigned int seed_bits, unsigned int& cost) {
+  unsigned int width = b.get_size();
+  unsigned int index = 0;
+  for(unsigned int i = 0; i < seed_bits; i++) {
+    index = (index << 1) | b.get_digit(width - 3 - i);
+  }
+  Binary seed = seed_entry(seed_bits, index, width);
+
+  // a * seed / 2: a logical shift of the full product, so no bit is lost
+  unsigned int cost_a = 0, cost_b = 0;
+  Binary scaled = mul(a, seed, cost_a);
+  scaled = scaled >> 1;
+  scaled.set_digit(scaled.get_size() - 1, 0);
+  a = scaled.truncate_to_size(width);
+  b = mul(b, seed, cost_b).truncate_to_size(width);
+  cost += seed_bits + max(cost_a, cost_b);
+}
+
+/*
+ * Random fraction in [0.5, 1) with one integer bit
+ */
+Binary random_significand(mt19937_64& rng, unsigned int width) {
+  Binary ret(width);
+  for(unsigned int i = 0; i < width; i++) {
+    ret.set_digit(i, i == width - 2 || (i < width - 2 && (rng() & 1)));
+  }
+  ret.set_decimal(width - 1);
+  return ret;
+}
+
+/**
+ * evaluate_config()
+ * @desc Divides the sampled operands with a configuration, charging the
+ *       calling thread's cost model
+ * @param config [in] configuration to run
+ * @param samples [in] number of operand pairs
+ * @param seed [in] random seed; the operands only depend on it and the width
+ * @return cost and error over the operands
+ */
+TuneResult evaluate_config(const TuneConfig& config, unsigned int samples, unsigned long seed) {
+  mt19937_64 rng(seed * 1000003 + config.width);
+
+  TuneResult result;
+  result.config = config;
+  result.worst_cost = 0;
+  result.mean_cost = 0;
+  result.worst_error = 0;
+  result.mean_error = 0;
+
+  for(unsigned int i = 0; i < samples; i++) {
+    Binary a = random_significand(rng, config.width);
+    Binary b = random_significand(rng, config.width);
+    double exact = a.toDouble() / b.toDouble();
+
+    unsigned int cost = 0;
+    if(config.seed_bits > 0) {
+      prescale(a, b, config.seed_bits, cost);
+    }
+
+    Binary q;
+    if(config.algorithm == MULTIPLICATIVE_DIVISION) {
+      q = multiplicative_division(a, b, cost, NULL, NULL, config.iterlimit);
+    }
+    else {
+      q = divisor_reciprocation(a, b, cost, NULL, NULL, config.iterlimit);
+    }
+
+    // Undo prescale()'s halving of the dividend
+    if(config.seed_bits > 0) {
+      q.decimal -= 1;
+    }
+
+    double error = fabs(q.toDouble() - exact);
+    result.worst_cost = max(result.worst_cost, cost);
+    result.mean_cost += cost;
+    result.worst_error = max(result.worst_error, error);
+    result.mean_error += error;
+  }
+
+  if(samples > 0) {
+    result.mean_cost /= samples;
+    result.mean_error /= samples;
+  }
+  return result;
+}
+
+
+/**
+ * TuneCache
+ * @desc Results kept in a text file, one "key | worst_cost mean_cost
+ *       worst_error mean_error" line per configuration
+ */
+class TuneCache {
+  public:
+
+    /**
+     * TuneCache Constructor
+     * @param p [in] file to load, and to append new results to
+     */
+    TuneCache(const string& p) : path(p) {
+      ifstream in(path.c_str());
+      string line;
+      while(getline(in, line)) {
+        size_t bar = line.find(" | ");
+        if(line.empty() || line[0] == '#' || bar == string::npos) {
+          continue;
+        }
+        TuneResult result;
+        stringstream fields(line.substr(bar + 3));
+        if(fields >> result.worst_cost >> result.mean_cost >> result.worst_error >> result.mean_error) {
+          entries[line.substr(0, bar)] = result;
+        }
+      }
+    }
+
+    /**
+     * find()
+     * @param key [in] tune_key() of the configuration
+     * @param result [out] cached cost and error, if found
+     * @return true if the configuration is cached
+     */
+    bool find(const string& key, TuneResult& result) const {
+      map<string, TuneResult>::const_iterator it = entries.find(key);
+      if(it == entries.end()) {
+        return false;
+      }
+      result.worst_cost = it->second.worst_cost;
+      result.mean_cost = it->second.mean_cost;
+      result.worst_error = it->second.worst_error;
+      result.mean_error = it->second.mean_error;
+      return true;
+    }
+
+    /**
+     * store()
+     * @desc Appends new results to the file
+     * @param keys [in] tune_key() of each result
+     * @param results [in] the results
+     */
+    void store(const vector<string>& keys, const vector<TuneResult>& results) {
+      if(keys.empty()) {
+        return;
+      }
+
+      bool exists = ifstream(path.c_str()).good();
+      ofstream out(path.c_str(), ios::app);
+      if(!out) {
+        throw "unable to write autotune cache";
+      }
+      if(!exists) {
+        out << "# key | worst_cost mean_cost worst_error mean_error" << endl;
+      }
+      out.precision(17);
+      for(unsigned int i = 0; i < keys.size(); i++) {
+        out << keys[i] << " | " << results[i].worst_cost << " " << results[i].mean_cost
+            << " " << results[i].worst_error << " " << results[i].mean_error << endl;
+        entries[keys[i]] = results[i];
+      }
+    }
+
+  private:
+    string path;
+    map<string, TuneResult> entries;
+};
+
+
+/**
+ * autotune()
+ * @desc Evaluates every configuration of a space, reusing cached results and
+ *       running the rest in parallel. Each worker charges the cost model of
+ *       the configuration it is running.
+ * @param space [in] values to search
+ * @param samples [in] operand pairs per configuration
+ * @param seed [in] random seed for the operands
+ * @param cache [in/out] results on disk
+ * @param pool [in] threads to run configurations on
+ * @param computed [out] If not NULL, number of configurations that were not cached
+ * @return a result for every configuration
+ */
+vector<TuneResult> autotune(const TuneSpace& space, unsigned int samples, unsigned long seed,
+                            TuneCache& cache, ThreadPool& pool, unsigned int* computed = NULL) {
+  vector<TuneConfig> configs = enumerate_configs(space);
+  vector<TuneResult> results(configs.size());
+
+  vector<unsigned int> missing;
+  for(unsigned int i = 0; i < configs.size(); i++) {
+    results[i].config = configs[i];
+    if(!cache.find(tune_key(configs[i], samples, seed), results[i])) {
+      missing.push_back(i);
+    }
+  }
+
+  // Indexed by [style][source]; the measured models share their netlist delays
+  ArrayMultiplierCosts array_formulas;
+  MeasuredCostModel tree_measured(NET_MULTIPLIER);
+  MeasuredCostModel array_measured(NET_ARRAY_MULTIPLIER);
+  CostModel* models[2][2] = {{&formula_costs(), &tree_measured},
+                             {&array_formulas, &array_measured}};
+
+  // Mul()s are passed no pool, so the workers never wait on each other
+  pool.parallel_for(0, missing.size(), [&](unsigned int lo, unsigned int hi) {
+    for(unsigned int i = lo; i < hi; i++) {
+      const TuneConfig& config = configs[missing[i]];
+      set_cost_model(models[config.style][config.source]);
+      results[missing[i]] = evaluate_config(config, samples, seed);
+      set_cost_model(NULL);
+    }
+  });
+
+  vector<string> keys;
+  vector<TuneResult> fresh;
+  for(unsigned int i = 0; i < missing.size(); i++) {
+    keys.push_back(tune_key(configs[missing[i]], samples, seed));
+    fresh.push_back(results[missing[i]]);
+  }
+  cache.store(keys, fresh);
+
+  if(computed != NULL) {
+    *computed = missing.size();
+  }
+  return results;
+}
+
+/**
+ * pareto_frontier()
+ * @desc Results not beaten on both worst-case cost and worst-case error.
+ *       Ties go to the smallest iterlimit, width and seed table.
+ * @param results [in] results to filter
+ * @return the frontier, cheapest first
+ */
+vector<TuneResult> pareto_frontier(vector<TuneResult> results) {
+  // Among equals the smallest configuration survives, then the first enumerated
+  stable_sort(results.begin(), results.end(), [](const TuneResult& x, const TuneResult& y) {
+    if(x.worst_cost != y.worst_cost) {
+      return x.worst_cost < y.worst_cost;
+    }
+    if(x.worst_error != y.worst_error) {
+      return x.worst_error < y.worst_error;
+    }
+    if(x.mean_cost != y.mean_cost) {
+      return x.mean_cost < y.mean_cost;
+    }
+    if(x.config.iterlimit != y.config.iterlimit) {
+      return x.config.iterlimit < y.config.iterlimit;
+    }
+    if(x.config.width != y.config.width) {
+      return x.config.width < y.config.width;
+    }
+    return x.config.seed_bits < y.config.seed_bits;
+  });
+
+  vector<TuneResult> frontier;
+  for(unsigned int i = 0; i < results.size(); i++) {
+    if(frontier.empty() || results[i].worst_error < frontier.back().worst_error) {
+      frontier.push_back(results[i]);
+    }
+  }
+  return frontier;
+}
+
+/*
+ * ostream insertion operator for a result; errors are given in correct bits
+ */
+ostream& operator <<(ostream& os, const TuneResult& result) {
+  double worst_bits = result.worst_error > 0 ? -log2(result.worst_error) : 64;
+  double mean_bits = result.mean_error > 0 ? -log2(result.mean_error) : 64;
+  return os << result.config
+            << "  Worst cost: " << result.worst_cost << "  Mean cost: " << result.mean_cost
+            << "  Worst bits: " << worst_bits << "  Mean bits: " << mean_bits;
+}
+
+#endif
@@ -6,8 +6,11 @@
 #include <algorithm>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include "thread_pool.h"
 
 static unsigned int ZERO = 0; // Only use for optional pass-by-reference parameters
+static const unsigned int PARALLEL_MUL_THRESHOLD = 256; // Narrower mul()s stay serial
 
 using namespace std;
 
@@ -44,6 +47,331 @@ bool full_add(const bool lhs, const bool rhs, bool& carry) {
 }
 
 
+typedef unsigned long long word_t;      // Machine word used for bit-parallel simulation
+static const unsigned int WORD_BITS = 64;
+
+/**
+ * PrefixLevel
+ * @desc Group generate/propagate signals after one level of a Kogge-Stone
+ *       adder. Bit i of generate is set if bits (i - span, i] produce a carry
+ *       (the carry-in counts as bit -1), bit i of propagate if they pass one through.
+ */
+struct PrefixLevel {
+  unsigned int span;            // Number of bits covered by each group
+  vector<word_t> generate;      // Group generate, packed LSB first
+  vector<word_t> propagate;     // Group propagate, packed LSB first
+};
+
+/**
+ * mask_words()
+ * @desc Clears the bits above width in a packed bit vector
+ * @param val [in/out] packed bit vector
+ * @param width [in] number of valid bits
+ */
+void mask_words(vector<word_t>& val, unsigned int width) {
+  if(width % WORD_BITS != 0 && !val.empty()) {
+    val.back() &= (static_cast<word_t>(1) << (width % WORD_BITS)) - 1;
+  }
+}
+
+/**
+ * shift_words_left()
+ * @desc Shifts a packed bit vector towards its MSB, filling with 0's
+ * @param val [in] packed bit vector
+ * @param dist [in] number of places to shift
+ * @param width [in] number of valid bits in val
+ * @param ret [out] the shifted bit vector, same length as val (must not alias val)
+ */
+void shift_words_left(const vector<word_t>& val, unsigned int dist, unsigned int width,
+                      vector<word_t>& ret) {
+  unsigned int words = dist / WORD_BITS;
+  unsigned int bits = dist % WORD_BITS;
+
+  ret.assign(val.size(), 0);
+  for(unsigned int i = words; i < val.size(); i++) {
+    ret[i] = val[i - words] << bits;
+    if(bits != 0 && i > words) {
+      ret[i] |= val[i - words - 1] >> (WORD_BITS - bits);
+    }
+  }
+  mask_words(ret, width);
+}
+
+/**
+ * shift_words_left()
+ * @desc Shifts a packed bit vector towards its MSB, filling with 0's
+ * @param val [in] packed bit vector
+ * @param dist [in] number of places to shift
+ * @param width [in] number of valid bits in val
+ * @return the shifted bit vector
+ */
+vector<word_t> shift_words_left(const vector<word_t>& val, unsigned int dist, unsigned int width) {
+  vector<word_t> ret;
+  shift_words_left(val, dist, width, ret);
+  return ret;
+}
+
+/**
+ * kogge_stone()
+ * @desc Adds two packed bit vectors with a Kogge-Stone parallel-prefix network.
+ *       Each prefix level combines groups twice as wide as the last one,
+ *       so the carries are resolved in ceil(log2(width)) word-parallel steps.
+ * @param lhs [in] Left hand side, packed LSB first
+ * @param rhs [in] Right hand side, packed LSB first
+ * @param width [in] number of bits to add
+ * @param carry [in/out] Carry in, set to the carry out of the MSB
+ * @param levels [out] If not NULL, receives the generate/propagate signals of every level
+ * @return packed sum
+ */
+vector<word_t> kogge_stone(const vector<word_t>& lhs, const vector<word_t>& rhs,
+                           unsigned int width, bool& carry,
+                           vector<PrefixLevel>* levels = NULL) {
+  unsigned int words = lhs.size();
+  vector<word_t> half_sum(words), g(words), p(words);
+
+  for(unsigned int i = 0; i < words; i++) {
+    g[i] = lhs[i] & rhs[i];
+    p[i] = lhs[i] ^ rhs[i];
+    half_sum[i] = p[i];
+  }
+
+  // Fold the carry in as a generate from below bit 0
+  if(carry && words > 0) {
+    g[0] |= p[0] & 1;
+  }
+
+  if(levels != NULL) {
+    levels->clear();
+  }
+
+  vector<word_t> g_low, p_low;
+  for(unsigned int span = 1; span < width; span *= 2) {
+    shift_words_left(g, span, width, g_low);
+    shift_words_left(p, span, width, p_low);
+    for(unsigned int i = 0; i < words; i++) {
+      g[i] |= p[i] & g_low[i];
+      p[i] &= p_low[i];
+    }
+
+    if(levels != NULL) {
+      PrefixLevel level;
+      level.span = 2 * span;
+      level.generate = g;
+      level.propagate = p;
+      levels->push_back(level);
+    }
+  }
+
+  // Carry into bit i is the group generate of bits [0, i)
+  vector<word_t>& carries = g_low;
+  shift_words_left(g, 1, width, carries);
+  if(carry && words > 0) {
+    carries[0] |= 1;
+  }
+  for(unsigned int i = 0; i < words; i++) {
+    half_sum[i] ^= carries[i];
+  }
+
+  carry = width > 0 && ((g[(width - 1) / WORD_BITS] >> ((width - 1) % WORD_BITS)) & 1);
+
+  return half_sum;
+}
+
+/**
+ * prefix_levels()
+ * @param width [in] number of bits in the adder
+ * @return number of prefix levels in a Kogge-Stone adder of that width
+ */
+unsigned int prefix_levels(unsigned int width) {
+  unsigned int levels = 0;
+  for(unsigned int span = 1; span < width; span *= 2) {
+    levels++;
+  }
+  return levels;
+}
+
+/**
+ * carry_save_add()
+ * @desc One row of full adders: reduces three packed summands to a sum and
+ *       a carry without propagating any carries
+ * @param x [in] first summand, packed LSB first
+ * @param y [in] second summand, packed LSB first
+ * @param z [in] third summand, packed LSB first
+ * @param width [in] number of bits
+ * @param sum [out] bitwise sum
+ * @param carry [out] bitwise carries, already shifted up one place
+ */
+void carry_save_add(const vector<word_t>& x, const vector<word_t>& y, const vector<word_t>& z,
+                    unsigned int width, vector<word_t>& sum, vector<word_t>& carry) {
+  unsigned int words = x.size();
+  vector<word_t> majority(words);
+  sum.resize(words);
+  for(unsigned int i = 0; i < words; i++) {
+    word_t half = x[i] ^ y[i];
+    sum[i] = half ^ z[i];
+    majority[i] = (x[i] & y[i]) | (half & z[i]);
+  }
+  shift_words_left(majority, 1, width, carry);
+}
+
+/**
+ * carry_save_levels()
+ * @param rows [in] number of summands
+ * @return levels of 3:2 carry-save adders needed to reduce them to two
+ */
+unsigned int carry_save_levels(unsigned int rows) {
+  unsigned int levels = 0;
+  for(; rows > 2; levels++) {
+    rows = 2 * (rows / 3) + rows % 3;
+  }
+  return levels;
+}
+
+/**
+ * carry_save_tree()
+ * @desc Reduces summands to two with levels of 3:2 carry-save adders
+ *       (a Wallace tree). The summands must not add up past width bits.
+ * @param rows [in/out] packed summands, left with exactly two
+ * @param width [in] number of bits
+ * @return number of carry-save levels
+ */
+unsigned int carry_save_tree(vector<vector<word_t> >& rows, unsigned int width) {
+  unsigned int words = (width + WORD_BITS - 1) / WORD_BITS;
+  unsigned int levels = 0;
+  while(rows.size() > 2) {
+    vector<vector<word_t> > next;
+    unsigned int i = 0;
+    for(; i + 2 < rows.size(); i += 3) {
+      next.push_back(vector<word_t>());
+      next.push_back(vector<word_t>());
+      carry_save_add(rows[i], rows[i + 1], rows[i + 2], width,
+                     next[next.size() - 2], next[next.size() - 1]);
+    }
+    for(; i < rows.size(); i++) {
+      next.push_back(rows[i]);
+    }
+    rows.swap(next);
+    levels++;
+  }
+  while(rows.size() < 2) {
+    rows.push_back(vector<word_t>(words, 0));
+  }
+  return levels;
+}
+
+
+/**
+ * CostModel
+ * @desc Delays add(), mul() and complement() charge for an operand width.
+ *       The defaults are the gate-level formulas; netlist.h substitutes the
+ *       delays measured on simulated netlists.
+ */
+class CostModel {
+  public:
+    virtual ~CostModel() {}
+
+    /**
+     * add_cost()
+     * @param width [in] number of bits in the adder
+     * @return generate/propagate, two gate levels per prefix level, sum
+     */
+    virtual unsigned int add_cost(unsigned int width) {
+      return 2 * prefix_levels(width) + 2;
+    }
+
+    /**
+     * mul_cost()
+     * @param size [in] operand width
+     * @return delay according to the full adder tree formula
+     */
+    virtual unsigned int mul_cost(unsigned int size) {
+      int floor_log2 = static_cast<int>(floor(log(size)/log(2)));
+      return 1 + (floor_log2 * 4) + (2 * size - 1) * 4;
+    }
+
+    /**
+     * complement_cost()
+     * @param size [in] operand width
+     * @return one level to invert plus the increment's carry chain
+     */
+    virtual unsigned int complement_cost(unsigned int size) {
+      return size;
+    }
+
+    /**
+     * carry_save_cost()
+     * @param width [in] number of bits in the row
+     * @return one row of full adders: XOR, AND, OR on the carry path
+     */
+    virtual unsigned int carry_save_cost(unsigned int width) {
+      return 3;
+    }
+
+    /**
+     * name()
+     * @return identifies the model, so costs recorded under one model are
+     *         not reused under another
+     */
+    virtual string name() const {
+      return "formula";
+    }
+};
+
+/*
+ * The formula cost model, shared by every thread
+ */
+CostModel& formula_costs() {
+  static CostModel formulas;
+  return formulas;
+}
+
+/*
+ * Slot holding the calling thread's cost model
+ */
+CostModel*& cost_model_slot() {
+  static thread_local CostModel* model = &formula_costs();
+  return model;
+}
+
+/**
+ * cost_model()
+ * @return the cost model in use on the calling thread
+ */
+CostModel& cost_model() {
+  return *cost_model_slot();
+}
+
+/**
+ * set_cost_model()
+ * @desc Switches the calling thread to another cost model
+ * @param model [in] the model to use, or NULL for the formulas. Must
+ *        outlive its use.
+ */
+void set_cost_model(CostModel* model) {
+  cost_model_slot() = model != NULL ? model : &formula_costs();
+}
+
+/*
+ * Slot holding the pool the calling thread's mul()s split across
+ */
+ThreadPool*& mul_pool_slot() {
+  static thread_local ThreadPool* pool = NULL;
+  return pool;
+}
+
+/**
+ * set_mul_pool()
+ * @desc Splits the calling thread's mul()s of PARALLEL_MUL_THRESHOLD bits or
+ *       more across pool. Safe to call from the pool's own tasks, whose
+ *       mul()s then stay serial.
+ * @param pool [in] the pool to use, or NULL to multiply serially. Must
+ *        outlive its use.
+ */
+void set_mul_pool(ThreadPool* pool) {
+  mul_pool_slot() = pool;
+}
+
+
 /**
  * Binary
  * @desc Represents a binary floating point number
@@ -178,6 +506,35 @@ class Binary {
       }
     }
 
+    /**
+     * leading_zeros()
+     * @return number of 0's above the most significant 1 (size if all 0)
+     */
+    unsigned int leading_zeros() const {
+      unsigned int i = 0;
+      while(i < size && number[size - 1 - i] == false) {
+        i++;
+      }
+      return i;
+    }
+
+    /**
+     * is_zero()
+     * @return true if every digit is 0
+     */
+    bool is_zero() const {
+      return leading_zeros() == size;
+    }
+
+    /**
+     * get_digit()
+     * @param loc [in] the position to read
+     * @return the value of the bit at position "loc" (false if out of range)
+     */
+    bool get_digit(unsigned int loc) const {
+      return loc < size && number[loc];
+    }
+
     /**
      * set_digit()
      * @param loc [in] the position to change
@@ -192,13 +549,45 @@ class Binary {
 
     /**
      * add()
-     * @desc Simulates fast addition using carry lookahead 2 scheme
+     * @desc Simulates fast addition using a Kogge-Stone parallel-prefix scheme
      * @param lhs [in] the left hand side
      * @param rhs [in] the right hand side
      * @param cost [in/out] Cost to perform operation
      * @return Binary value with the result
      */
     friend Binary add(const Binary& lhs, const Binary& rhs, unsigned int& cost) {
+      return add(lhs, rhs, cost, NULL);
+    }
+
+    /**
+     * add()
+     * @desc Simulates fast addition using a Kogge-Stone parallel-prefix scheme
+     * @param lhs [in] the left hand side
+     * @param rhs [in] the right hand side
+     * @param cost [in/out] Cost to perform operation
+     * @param levels [out] If not NULL, receives the intermediate prefix levels
+     * @return Binary value with the result
+     */
+    friend Binary add(const Binary& lhs, const Binary& rhs, unsigned int& cost,
+                      vector<PrefixLevel>* levels) {
+      return add(lhs, rhs, cost, levels, false);
+    }
+
+    /**
+     * add()
+     * @desc Simulates fast addition using a Kogge-Stone parallel-prefix scheme
+     * @param lhs [in] the left hand side
+     * @param rhs [in] the right hand side
+     * @param cost [in/out] Cost to perform operation
+     * @param levels [out] If not NULL, receives the intermediate prefix levels
+     * @param negate_rhs [in] add the 2's complement of rhs instead. When all
+     *        of rhs lines up from the bottom of the result, this is done by
+     *        inverting it and setting the adder's carry in. The complement's
+     *        cost is left to the caller.
+     * @return Binary value with the result
+     */
+    friend Binary add(const Binary& lhs, const Binary& rhs, unsigned int& cost,
+                      vector<PrefixLevel>* levels, bool negate_rhs) {
       bool carry = false;
       unsigned int sz = max(lhs.size, rhs.size);
       Binary result(sz);
@@ -217,27 +606,33 @@ class Binary {
       unsigned int l_start = max(static_cast<int>(result.decimal - lhs.decimal), 0);
       unsigned int r_start = max(static_cast<int>(result.decimal - rhs.decimal), 0);
 
-      // Add
-      for(unsigned int i = 0; i < sz; i++) {
-        if(i >= l_start && i >= r_start && l < lhs.size && r < rhs.size) {
-          result.number[i] = full_add(lhs.number[l++], rhs.number[r++], carry);
-        }
-        else if(i >= l_start && l < lhs.size) {
-          result.number[i] = full_add(lhs.number[l++], false, carry);
-        }
-        else if(i >= r_start && r < rhs.size) {
-          result.number[i] = full_add(rhs.number[r++], false, carry);
-        }
-        else {
-          result.number[i] = full_add(false, false, carry);
-        }
+      // Line both operands up with the result and pack them into words
+      vector<word_t> l_words = lhs.to_words(l, l_start, sz);
+      vector<word_t> r_words;
+      if(!negate_rhs) {
+        r_words = rhs.to_words(r, r_start, sz);
+      }
+      else if(r == 0 && r_start == 0 && !rhs.is_zero()) {
+        // -rhs = ~rhs + 1, and no carry leaves ~rhs + 1 since rhs != 0
+        r_words = rhs.to_words(r, r_start, sz, true);
+        carry = true;
+      }
+      else {
+        unsigned int unused_cost = 0;
+        Binary negated = rhs;
+        negated.complement(unused_cost);
+        r_words = negated.to_words(r, r_start, sz);
       }
 
+      // Add
+      vector<word_t> sum = kogge_stone(l_words, r_words, sz, carry, levels);
+      result.from_words(sum);
+
       result.overflow = carry;
       result.carryin = carry; // I think this is right for subtraction
 
-      // Update cost
-      cost += 4 * (sz/4) + 1;
+      // Update cost: generate/propagate, two gate levels per prefix level, sum
+      cost += cost_model().add_cost(sz);
 
       return result;
     }
@@ -262,45 +657,69 @@ class Binary {
       Binary l = lhs;
 
       // Shift lhs left as much as we can, dropping off LSB's that are 0.
-      while(l.number[l.size - 1] == false)
-      {
-        l = l << 1;
-        l.decimal++;
-      }
+      unsigned int l_shift = l.leading_zeros();
+      l = l << l_shift;
+      l.decimal += l_shift;
 
       // Sign-extend rhs as much as we need
-      while(r.number[r.size - 1] == false && r.decimal < l.decimal)
-      {
-        r = r << 1;
-        r.decimal++;
+      if(r.decimal < l.decimal) {
+        // A zero rhs never gets an MSB set, so it just takes lhs's decimal
+        unsigned int r_shift = l.decimal - r.decimal;
+        if(!r.is_zero()) {
+          r_shift = min(r.leading_zeros(), r_shift);
+        }
+        r = r << r_shift;
+        r.decimal += r_shift;
       }
 
-      while(r.decimal > l.decimal)
-      {
+      if(r.decimal > l.decimal) {
         // Losing some data..
-        if(r.number[0] == true)
-          r.truncate = true;
+        unsigned int r_shift = r.decimal - l.decimal;
+        for(unsigned int i = 0; i < r_shift && i < r.size; i++) {
+          if(r.number[i] == true)
+            r.truncate = true;
+        }
 
-        r = r >> 1;
-        r.decimal--;
+        // Shifting past the sign bit only copies it further
+        r = r >> min(r_shift, static_cast<unsigned int>(r.size - 1));
+        r.decimal = l.decimal;
       }
 
-      r.complement(cost);
-
+      // Take the 2's complement inside the adder
+      cost += cost_model().complement_cost(r.size);
 
-      Binary result = add(l, r, cost);
+      Binary result = add(l, r, cost, NULL, true);
       return result;
     }
 
     /**
      * mul()
-     * @desc Simulates fast multiplication using full adder tree
+     * @desc Simulates fast multiplication using full adder tree, on the
+     *       pool given to set_mul_pool() if there is one
      * @param p_b [in] the left hand side
      * @param p_q [in] the right hand side
      * @param cost [in/out] Cost to perform operation
      * @return Binary value with the result
      */
     friend Binary mul(const Binary& p_b, const Binary& p_q, unsigned int& cost) {
+      return mul(p_b, p_q, cost, mul_pool_slot());
+    }
+
+    /**
+     * mul()
+     * @desc Simulates fast multiplication using full adder tree, generating
+     *       the summands and reducing each tree level on a thread pool.
+     *       The pairing is the same as the serial path, so the result is too.
+     * @param p_b [in] the left hand side
+     * @param p_q [in] the right hand side
+     * @param cost [in/out] Cost to perform operation
+     * @param pool [in] If not NULL, the threads to split the work across.
+     *        From one of pool's own tasks the work stays on the calling thread.
+     * @param threshold [in] Operand width below which the work stays serial
+     * @return Binary value with the result
+     */
+    friend Binary mul(const Binary& p_b, const Binary& p_q, unsigned int& cost,
+                      ThreadPool* pool, unsigned int threshold = PARALLEL_MUL_THRESHOLD) {
       Binary b = p_b, q = p_q;
       int size = p_q.get_size();
       if(p_b.get_size() > p_q.get_size()) {
@@ -310,46 +729,66 @@ class Binary {
       if(p_b.get_size() < p_q.get_size()) {
         b = p_b.pad_to_size(size);
       }
-      int floor_log2 = static_cast<int>(floor(log(size)/log(2)));
+      if(size < static_cast<int>(threshold)) {
+        pool = NULL;
+      }
 
-      // build matrix of summands
-      Binary *matrix_of_summands = new Binary[size];
-      for(int i = 0; i < size; i++) {
-        matrix_of_summands[i] = Binary(2*size-1);
-        for(int j = 0; j < (2*size-1); j++) {
-          if(i <= j && j < (size + i)) {
-            matrix_of_summands[i].number[j] = q.number[i] & b.number[j-i];
-          } else {
-            matrix_of_summands[i].number[j] = 0;
+      // Runs body over [0, n), split across the pool if there is one
+      function<void(unsigned int, const function<void(unsigned int, unsigned int)>&)> run =
+        [pool](unsigned int n, const function<void(unsigned int, unsigned int)>& body) {
+          if(pool != NULL) {
+            pool->parallel_for(0, n, body);
+          }
+          else {
+            body(0, n);
+          }
+        };
+
+      // build matrix of summands, packed into words: row i is b << i if q_i is set
+      unsigned int width = 2*size-1;
+      vector<word_t> b_words = b.to_words(0, 0, width);
+      vector<vector<word_t> > results(size);
+      run(size, [&](unsigned int lo, unsigned int hi) {
+        for(unsigned int i = lo; i < hi; i++) {
+          if(q.number[i]) {
+            results[i] = shift_words_left(b_words, i, width);
+          }
+          else {
+            results[i].assign(b_words.size(), 0);
           }
         }
-      }
-
-      Binary *results = new Binary[size];
-      for(int i = 0; i < size; i++) {
-        results[i] = matrix_of_summands[i];
-      }
+      });
 
+      // Add neighbouring pairs until one summand is left. Each level writes
+      // to a separate buffer so the pairs can be added concurrently.
+      vector<vector<word_t> > next((size + 1) / 2);
+      bool carry = false;
       int results_size = size;
       while(results_size > 1){
-        unsigned int i, next = 0, unused_cost;
-        for(i = 0; i < results_size/2; i++, next+=2) {
-          results[i] = add(results[next], results[next + 1], unused_cost);
-        }
+        run(results_size / 2, [&](unsigned int lo, unsigned int hi) {
+          for(unsigned int i = lo; i < hi; i++) {
+            bool pair_carry = false;
+            next[i] = kogge_stone(results[2 * i], results[2 * i + 1], width, pair_carry);
+            if(results_size == 2) {
+              carry = pair_carry;
+            }
+          }
+        });
         if (results_size % 2) {
-          results[i] = results[results_size-1];
+          next[results_size / 2].swap(results[results_size - 1]);
         }
         results_size = (results_size + 1) / 2;
+        results.swap(next);
       }
 
-      Binary result = results[0];
+      Binary result(width);
+      result.from_words(results[0]);
       result.decimal = b.decimal + q.decimal;
-
-      delete[] matrix_of_summands;
-      delete[] results;
+      result.overflow = carry;
+      result.carryin = carry;
 
       // According to full adder tree formula
-      cost += 1 + (floor_log2 * 4) + (2 * size - 1) * 4;
+      cost += cost_model().mul_cost(size);
       return result;
     }
 
@@ -467,7 +906,38 @@ class Binary {
       }
 
       // Add cost
-      cost += size;
+      cost += cost_model().complement_cost(size);
+    }
+
+    /**
+     * to_words()
+     * @desc Packs the digits into words, LSB first, at an offset
+     * @param from [in] index of the first digit to pack
+     * @param start [in] bit position the first digit is packed into
+     * @param width [in] number of bits in the packed vector
+     * @param invert [in] pack the inverted digits instead
+     * @return packed bit vector with 0's outside the copied digits
+     */
+    vector<word_t> to_words(unsigned int from, unsigned int start, unsigned int width,
+                            bool invert = false) const {
+      vector<word_t> ret((width + WORD_BITS - 1) / WORD_BITS, 0);
+      for(unsigned int i = start; i < width && from < size; i++, from++) {
+        if(number[from] != invert) {
+          ret[i / WORD_BITS] |= static_cast<word_t>(1) << (i % WORD_BITS);
+        }
+      }
+      return ret;
+    }
+
+    /**
+     * from_words()
+     * @desc Unpacks a bit vector, LSB first, into the digits
+     * @param val [in] packed bit vector with at least size bits
+     */
+    void from_words(const vector<word_t>& val) {
+      for(unsigned int i = 0; i < size; i++) {
+        number[i] = (val[i / WORD_BITS] >> (i % WORD_BITS)) & 1;
+      }
     }
 
     /**
@@ -0,0 +1,125 @@
+#ifndef CONSTANT_POOL_H
+#define CONSTANT_POOL_H
+
+#include "binary.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+static const unsigned int POOL_TABLE_WIDTH = 64; // Widths below this are looked up without locking
+
+
+/**
+ * ConstantKind
+ * @desc Constants the algorithms need at every operand width
+ */
+enum ConstantKind {
+  CONST_NEAR_ONE,               // Largest value below 1: all fraction bits set
+  CONST_HALF,                   // 0.5
+  CONST_TWO,                    // 2
+  CONST_KINDS
+};
+
+
+/**
+ * ConstantPool
+ * @desc Immutable constants indexed by (kind, width, decimal position), built
+ *       on first use. A returned reference stays valid for the life of the
+ *       pool, so callers borrow it instead of copying it.
+ */
+class ConstantPool {
+  public:
+
+    ConstantPool() {
+      for(unsigned int i = 0; i < CONST_KINDS * POOL_TABLE_WIDTH * POOL_TABLE_WIDTH; i++) {
+        table[i] = NULL;
+      }
+    }
+
+    ~ConstantPool() {
+      for(unsigned int i = 0; i < CONST_KINDS * POOL_TABLE_WIDTH * POOL_TABLE_WIDTH; i++) {
+        delete table[i].load();
+      }
+    }
+
+    /**
+     * get()
+     * @param kind [in] which constant
+     * @param width [in] number of bits
+     * @param decimal [in] decimal position
+     * @return the constant, built if this is the first request for it
+     */
+    const Binary& get(ConstantKind kind, unsigned int width, unsigned int decimal) {
+      if(width < POOL_TABLE_WIDTH && decimal < POOL_TABLE_WIDTH) {
+        atomic<const Binary*>& slot = table[(kind * POOL_TABLE_WIDTH + width) * POOL_TABLE_WIDTH + decimal];
+        const Binary* value = slot.load(memory_order_acquire);
+        if(value == NULL) {
+          lock_guard<mutex> guard(lock);
+          value = slot.load(memory_order_relaxed);
+          if(value == NULL) {
+            value = build(kind, width, decimal);
+            slot.store(value, memory_order_release);
+          }
+        }
+        return *value;
+      }
+
+      lock_guard<mutex> guard(lock);
+      shared_ptr<const Binary>& value = wide[Key(kind, Key::second_type(width, decimal))];
+      if(!value) {
+        value.reset(build(kind, width, decimal));
+      }
+      return *value;
+    }
+
+    /**
+     * prefill()
+     * @desc Builds the constants the algorithms use for every width up to max_width
+     * @param max_width [in] widest operand expected
+     */
+    void prefill(unsigned int max_width) {
+      for(unsigned int width = 2; width <= max_width; width++) {
+        get(CONST_NEAR_ONE, width, width - 1);
+        get(CONST_HALF, width, width - 1);
+        get(CONST_TWO, width, 0);
+      }
+    }
+
+  private:
+    typedef pair<ConstantKind, pair<unsigned int, unsigned int> > Key;
+
+    /*
+     * Builds a new constant
+     */
+    static Binary* build(ConstantKind kind, unsigned int width, unsigned int decimal) {
+      Binary* value = new Binary(width);
+      for(unsigned int i = 0; i < width; i++) {
+        value->set_digit(i, kind == CONST_NEAR_ONE && i < decimal);
+      }
+      if(kind == CONST_HALF && decimal > 0) {
+        value->set_digit(decimal - 1, 1);
+      }
+      if(kind == CONST_TWO) {
+        value->set_digit(decimal + 1, 1);
+      }
+      value->set_decimal(decimal);
+      return value;
+    }
+
+    atomic<const Binary*> table[CONST_KINDS * POOL_TABLE_WIDTH * POOL_TABLE_WIDTH];
+    map<Key, shared_ptr<const Binary> > wide;  // Constants too wide for the table
+    mutex lock;                                 // Guards building and the wide map
+};
+
+/*
+ * Process-wide constant pool
+ */
+ConstantPool& constant_pool() {
+  static ConstantPool pool;
+  return pool;
+}
+
+#endif
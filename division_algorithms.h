@@ -1,8 +1,69 @@
+#ifndef DIVISION_ALGORITHMS_H
+#define DIVISION_ALGORITHMS_H
+
+#include "binary.h"
+#include "division_cache.h"
+#include "constant_pool.h"
 #include <iostream>
 
 using namespace std;
 
 static const int ITERLIMIT = 5;
+static const int DR_ITERLIMIT = 32; // Guards against the convergence test never passing
+
+
+/**
+ * Algorithm
+ * @desc Division and root algorithms, for callers that pick one at run time
+ */
+enum Algorithm {
+  MULTIPLICATIVE_DIVISION,
+  DIVISOR_RECIPROCATION,
+  GOLDSCHMIDT_SQRT,             // Roots only use the divisor as their operand
+  GOLDSCHMIDT_RSQRT,
+  NEWTON_RSQRT
+};
+
+
+/**
+ * Computes divisor-side step i of multiplicative division if it isn't known yet
+ * @param seq [in/out] Divisor sequence to extend
+ * @param i [in] Iteration number
+ * @param one [in] Value the divisor iterate converges to
+ * @param size [in] Working width
+ * @return step i, valid as long as seq, or NULL if the divisor converged
+ *         before iteration i
+ */
+const DivisorStep* md_divisor_step(DivisorSequence& seq, unsigned int i, const Binary& one,
+                                   unsigned int size) {
+  lock_guard<mutex> guard(seq.lock);
+
+  while(seq.steps.size() <= i && !seq.converged) {
+    if(seq.divisor == one) {
+      seq.converged = true;
+      break;
+    }
+
+    DivisorStep next;
+    next.factor = seq.factor;
+    next.pre_cost = 0;
+    next.divisor_cost = 0;
+    next.post_cost = 0;
+
+    seq.divisor = mul(seq.divisor, seq.factor, next.divisor_cost).truncate_to_size(size);
+
+    seq.factor = seq.divisor;
+    seq.factor.complement(next.post_cost);
+
+    seq.steps.push_back(next);
+  }
+
+  // Steps are only ever appended, which leaves references to a deque valid
+  if(i >= seq.steps.size()) {
+    return NULL;
+  }
+  return &seq.steps[i];
+}
 
 
 /**
@@ -10,49 +71,241 @@ static const int ITERLIMIT = 5;
  * @param a [in] Left hand side
  * @param b [in] Right hand side
  * @param cost [in/out] Cost to perform operation
+ * @param iterations [out] If not NULL, number of iterations performed
+ * @param cache [in] If not NULL, reuses the f_i computed for the same divisor
+ * @param iterlimit [in] Maximum number of iterations
  * @return Binary value with the result
  */
-Binary multiplicative_division(const Binary& a, const Binary& b, unsigned int& cost) {
+Binary multiplicative_division(const Binary& a, const Binary& b, unsigned int& cost,
+                               unsigned int* iterations = NULL, DivisionCache* cache = NULL,
+                               int iterlimit = ITERLIMIT) {
   int size = a.get_size();
-  Binary one(size);
-  for(int i = 0; i < size; i++){
-    one.set_digit(i, 1);
-  }
-  one.set_digit(size-1, 0);
-  one.set_decimal(size-1);
+  const Binary& one = constant_pool().get(CONST_NEAR_ONE, size, size-1);
 
-  Binary f_i = one;
   Binary a_i = a;
-  Binary b_i = b;
+  unsigned int cost_a_i;
+  int i;
 
-  unsigned int cost_a_i, cost_b_i;
-  for(int i = 0; i < ITERLIMIT && b_i != one; i++) {
-    cost_a_i = 0;
-    cost_b_i = 0;
+  if(cache == NULL) {
+    // Nothing to share: iterate on a private b_i, starting from the pool's f_0
+    Binary b_i = b, f_next;
+    const Binary* f_i = &one;
+    unsigned int cost_b_i;
+    for(i = 0; i < iterlimit && b_i != one; i++) {
+      cost_a_i = 0;
+      cost_b_i = 0;
 
-    a_i = mul(a_i, f_i, cost_a_i).truncate_to_size(size);
-    b_i = mul(b_i, f_i, cost_b_i).truncate_to_size(size);
+      a_i = mul(a_i, *f_i, cost_a_i).truncate_to_size(size);
+      b_i = mul(b_i, *f_i, cost_b_i).truncate_to_size(size);
 
-    // Assume multiplications can be done in parallel, then cost is the more 
-    // expensive of the two multiplications.
-    cost += max(cost_a_i, cost_b_i);
+      // Assume multiplications can be done in parallel, then cost is the more 
+      // expensive of the two multiplications.
+      cost += max(cost_a_i, cost_b_i);
 
-    f_i = b_i;
-    f_i.complement(cost);
+      // Complement of b_i to form f_i+1
+      f_next = b_i;
+      f_next.complement(cost);
+      f_i = &f_next;
+    }
+  }
+  else {
+    // The f_i and b_i only depend on the divisor
+    shared_ptr<DivisorSequence> seq = cache->lookup(cache_key("md", size, b), b, one);
+    const DivisorStep* step;
+    for(i = 0; i < iterlimit && (step = md_divisor_step(*seq, i, one, size)) != NULL; i++) {
+      cost_a_i = 0;
+
+      a_i = mul(a_i, step->factor, cost_a_i).truncate_to_size(size);
+      cost += max(cost_a_i, step->divisor_cost);
+      cost += step->post_cost;
+    }
+  }
+  if(iterations != NULL) {
+    *iterations = i;
   }
-  
+
   return a_i;
 }
 
 
+/**
+ * CarrySave
+ * @desc A value held redundantly as sum + carry, both fractions with one
+ *       integer bit and non-negative
+ */
+struct CarrySave {
+  Binary sum;
+  Binary carry;
+};
+
+
+/**
+ * Multiplies two carry-save values, leaving the product in carry-save form
+ * @desc Every part of x times every part of y gives a summand row, reduced by
+ *       a tree of 3:2 carry-save adders. The low half of each part is
+ *       dropped, so the result can be up to 2 ulps low.
+ * @param x [in] Multiplicand
+ * @param y [in] Multiplier
+ * @param plus_x [in] Also add x, giving x * (1 + y) for the cost of one more row pair
+ * @param cost [in/out] Cost to perform operation
+ * @return x * y (+ x) at x's width
+ */
+CarrySave carry_save_mul(const CarrySave& x, const CarrySave& y, bool plus_x, unsigned int& cost) {
+  unsigned int size = x.sum.get_size();
+  unsigned int width = 2 * size - 1;
+  const Binary* x_parts[2] = {&x.sum, &x.carry};
+  const Binary* y_parts[2] = {&y.sum, &y.carry};
+
+  // Row for x part k and bit j of y part l is x_k << j if that bit is set.
+  // The hardware has every row; only the non-zero ones need simulating.
+  unsigned int row_count = 4 * size + (plus_x ? 2 : 0);
+  vector<vector<word_t> > rows;
+  for(unsigned int l = 0; l < 2; l++) {
+    for(unsigned int j = 0; j < size; j++) {
+      for(unsigned int k = 0; k < 2; k++) {
+        if(y_parts[l]->get_digit(j) && !x_parts[k]->is_zero()) {
+          rows.push_back(x_parts[k]->to_words(0, j, width));
+        }
+      }
+    }
+  }
+  if(plus_x) {
+    rows.push_back(x.sum.to_words(0, size - 1, width));
+    rows.push_back(x.carry.to_words(0, size - 1, width));
+  }
+
+  carry_save_tree(rows, width);
+  unsigned int levels = carry_save_levels(row_count);
+
+  CarrySave ret;
+  Binary sum(width), carry(width);
+  sum.from_words(rows[0]);
+  carry.from_words(rows[1]);
+  sum.set_decimal(width - 1);
+  carry.set_decimal(width - 1);
+  ret.sum = sum.truncate_to_size(size);
+  ret.carry = carry.truncate_to_size(size);
+
+  // Partial products, then the carry-save levels
+  cost += 1 + levels * cost_model().carry_save_cost(width);
+  return ret;
+}
+
+
+/**
+ * Performs a / b = ? using multiplicative division with carry-save iterates
+ * @desc Tracks e_i = 1 - b_i instead of b_i: then f_i = 2 - b_i = 1 + e_i
+ *       needs no complement, and e_i+1 = 1 - b_i * f_i = e_i^2. e_0 is the
+ *       inverted fraction bits of b plus 1 ulp, left as a sum and a carry.
+ *       a_i and e_i stay in carry-save form; only e_0, for the iteration
+ *       count, and the quotient are resolved.
+ * @param a [in] Left hand side, a fraction with one integer bit
+ * @param b [in] Right hand side, a fraction below 1 with one integer bit
+ * @param cost [in/out] Cost to perform operation
+ * @param iterations [out] If not NULL, number of iterations performed
+ * @param iterlimit [in] Maximum number of iterations
+ * @return Binary value with the result
+ */
+Binary carry_save_division(const Binary& a, const Binary& b, unsigned int& cost,
+                           unsigned int* iterations = NULL, int iterlimit = ITERLIMIT) {
+  unsigned int size = a.get_size();
+  Binary divisor = b.get_size() < size ? b.pad_to_size(size) : b.truncate_to_size(size);
+  if(divisor.get_digit(size - 1)) {
+    throw "carry-save division needs a divisor below 1";
+  }
+
+  CarrySave a_i, e_i;
+  a_i.sum = a;
+  a_i.carry = Binary(size);
+  e_i.sum = divisor;
+  e_i.carry = Binary(size);
+
+  // 1 - b = ~b + 1 ulp, with the integer bit left at 0
+  for(unsigned int i = 0; i < size; i++) {
+    a_i.carry.set_digit(i, 0);
+    e_i.sum.set_digit(i, i + 1 < size && !divisor.get_digit(i));
+    e_i.carry.set_digit(i, i == 0);
+  }
+  a_i.carry.set_decimal(size - 1);
+  e_i.carry.set_decimal(size - 1);
+  cost += 1;
+
+  // e_i = e_0^(2^i) less what truncation drops, so squaring a bound on e_0
+  // gives the iteration count up front. e_0 is resolved once, beside the
+  // first iteration, or alone if there is none; the iterates themselves
+  // are never resolved.
+  unsigned int cost_a_i, cost_e_i, cost_e_0 = 0;
+  double e_bound = add(e_i.sum, e_i.carry, cost_e_0).toDouble();
+  double ulp = pow(2, -static_cast<int>(size) + 1);
+  int i;
+  for(i = 0; i < iterlimit; i++) {
+    // Converged once b_i is within an ulp of one, like the b_i != one test
+    // of multiplicative_division
+    if(e_bound < 2 * ulp) {
+      break;
+    }
+    e_bound *= e_bound;
+
+    cost_a_i = 0;
+    cost_e_i = 0;
+
+    // a_i * (1 + e_i) and e_i^2 in parallel
+    a_i = carry_save_mul(a_i, e_i, true, cost_a_i);
+    e_i = carry_save_mul(e_i, e_i, false, cost_e_i);
+
+    cost += max(max(cost_a_i, cost_e_i), cost_e_0);
+    cost_e_0 = 0;
+  }
+  cost += cost_e_0;
+  if(iterations != NULL) {
+    *iterations = i;
+  }
+
+  return add(a_i.sum, a_i.carry, cost);
+}
+
+
+/**
+ * Computes divisor-side step i of divisor reciprocation if it isn't known yet
+ * @param seq [in/out] Divisor sequence to extend
+ * @param i [in] Iteration number
+ * @param two [in] The constant 2 at the working width
+ * @param size [in] Working width
+ * @return step i, valid as long as seq
+ */
+const DivisorStep* dr_divisor_step(DivisorSequence& seq, unsigned int i, const Binary& two,
+                                   unsigned int size) {
+  lock_guard<mutex> guard(seq.lock);
+
+  while(seq.steps.size() <= i) {
+    DivisorStep next;
+    next.pre_cost = 0;
+    next.divisor_cost = 0;
+    next.post_cost = 0;
+
+    next.factor = sub(two, seq.divisor, next.pre_cost);
+    seq.divisor = mul(seq.divisor, next.factor, next.divisor_cost).resize(size);
+
+    seq.steps.push_back(next);
+  }
+
+  return &seq.steps[i];
+}
+
+
 /**
  * Performs a / b = ? using divisor reciprocation method
  * @param a [in] Left hand side
  * @param b [in] Right hand side
  * @param cost [in/out] Cost to perform operation
+ * @param iterations [out] If not NULL, number of iterations performed
+ * @param cache [in] If not NULL, reuses the 2 - a_i computed for the same normalized divisor
+ * @param iterlimit [in] Maximum number of iterations
  * @return Binary value with the result
  */
-Binary divisor_reciprocation(const Binary& aP, const Binary& bP, unsigned int& cost) {
+Binary divisor_reciprocation(const Binary& aP, const Binary& bP, unsigned int& cost,
+                             unsigned int* iterations = NULL, DivisionCache* cache = NULL,
+                             int iterlimit = DR_ITERLIMIT) {
   Binary a = aP;
   Binary b = bP;
 
@@ -85,31 +338,52 @@ Binary divisor_reciprocation(const Binary& aP, const Binary& bP, unsigned int& c
 
   Binary a_0 = b.resize(size); 
 
-  Binary x_i = x_0, a_i = a_0;
-  Binary TWO(size, b.get_decimal());
-  TWO = "010.0";
-  TWO = TWO.resize(size);
+  Binary x_i = x_0;
+  const Binary& TWO = constant_pool().get(CONST_TWO, size, 0);
 
+  // The a_i and 2 - a_i only depend on the normalized divisor. Without a
+  // cache, a_0 itself is iterated and each step formed in local.
+  shared_ptr<DivisorSequence> seq;
+  if(cache != NULL) {
+    seq = cache->lookup(cache_key("dr", size, b), a_0, TWO);
+  }
+  DivisorStep local;
+  const DivisorStep* step;
+
+  int i = 0;
   while(abs(x_i.toDouble() - a.toDouble() / b.toDouble()) >= pow(2, -size + 3) &&
-        x_i.get_size() <= size) // Division overflow
+        x_i.get_size() <= size && // Division overflow
+        i < iterlimit)
   {
-    // Perform the operations in parallel
-    unsigned int costX = cost, costA = cost;
+    if(seq) {
+      step = dr_divisor_step(*seq, i, TWO, size);
+    }
+    else {
+      local.pre_cost = 0;
+      local.divisor_cost = 0;
+      local.factor = sub(TWO, a_0, local.pre_cost);
+      a_0 = mul(a_0, local.factor, local.divisor_cost).resize(size);
+      step = &local;
+    }
 
-    Binary sub_x = sub(TWO, a_0, costX);
-    Binary sub_a = sub(TWO, a_0, costA);
+    // Perform the operations in parallel
+    unsigned int costX = cost + step->pre_cost;
+    unsigned int costA = cost + step->pre_cost + step->divisor_cost;
 
-    x_i = mul(x_0, sub_x, costX);
-    a_i = mul(a_0, sub_a, costA);
+    x_i = mul(x_0, step->factor, costX);
     cost = max(costX, costA);
 
     x_i = x_i.resize(size);
-    a_i = a_i.resize(size);
 
     // x_0 is really x_i-1 for the purposes of this loop.
     x_0 = x_i;
-    a_0 = a_i;
+    i++;
+  }
+  if(iterations != NULL) {
+    *iterations = i;
   }
 
   return x_i;
 }
+
+#endif
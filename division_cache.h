@@ -0,0 +1,143 @@
+#ifndef DIVISION_CACHE_H
+#define DIVISION_CACHE_H
+
+#include "binary.h"
+#include <atomic>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+
+/**
+ * DivisorStep
+ * @desc Divisor-side work of one iteration. Only the factor depends on the
+ *       divisor, so the same steps can be replayed against any dividend.
+ */
+struct DivisorStep {
+  Binary factor;                // Factor the dividend iterate is multiplied by
+  unsigned int pre_cost;        // Cost to form the factor before the multiplications
+  unsigned int divisor_cost;    // Cost of the divisor-side multiplication
+  unsigned int post_cost;       // Cost to form the next factor after the multiplications
+};
+
+/**
+ * DivisorSequence
+ * @desc Steps computed so far for one normalized divisor, extended lazily
+ *       by whichever division first needs a step that isn't there yet.
+ */
+struct DivisorSequence {
+  mutex lock;
+  deque<DivisorStep> steps;
+  Binary divisor;               // Divisor iterate after the last recorded step
+  Binary factor;                // Factor for the next step, if it is formed up front
+  bool converged;               // No further steps exist
+
+  DivisorSequence(const Binary& d, const Binary& f) : divisor(d), factor(f), converged(false) {}
+};
+
+
+/**
+ * DivisionCache
+ * @desc Bounded, thread-safe LRU cache of divisor sequences keyed on the
+ *       normalized divisor bits, operand width and cost model.
+ */
+class DivisionCache {
+  public:
+
+    /**
+     * DivisionCache Constructor
+     * @param cap [in] maximum number of divisors to remember
+     */
+    DivisionCache(unsigned int cap) : capacity(cap), hit_count(0), miss_count(0) {}
+
+    /**
+     * lookup()
+     * @desc Finds the sequence for key, starting a new one on a miss
+     * @param key [in] normalized divisor key
+     * @param divisor [in] initial divisor iterate for a new sequence
+     * @param factor [in] initial factor for a new sequence
+     * @return the shared sequence for key
+     */
+    shared_ptr<DivisorSequence> lookup(const string& key, const Binary& divisor, const Binary& factor) {
+      lock_guard<mutex> guard(lock);
+
+      map<string, Entry>::iterator it = entries.find(key);
+      if(it != entries.end()) {
+        hit_count++;
+        lru.splice(lru.begin(), lru, it->second.position);
+        return it->second.sequence;
+      }
+
+      miss_count++;
+      Entry entry;
+      entry.sequence = make_shared<DivisorSequence>(divisor, factor);
+      lru.push_front(key);
+      entry.position = lru.begin();
+      entries[key] = entry;
+
+      // Sequences still in use by a division stay alive through their shared_ptr
+      while(entries.size() > capacity) {
+        entries.erase(lru.back());
+        lru.pop_back();
+      }
+
+      return entry.sequence;
+    }
+
+    /**
+     * hits()
+     * @return number of lookups that found a cached divisor
+     */
+    unsigned long hits() const {
+      return hit_count;
+    }
+
+    /**
+     * misses()
+     * @return number of lookups that started a new divisor
+     */
+    unsigned long misses() const {
+      return miss_count;
+    }
+
+    /**
+     * get_size()
+     * @return number of divisors currently cached
+     */
+    unsigned int get_size() {
+      lock_guard<mutex> guard(lock);
+      return entries.size();
+    }
+
+  private:
+    struct Entry {
+      shared_ptr<DivisorSequence> sequence;
+      list<string>::iterator position;
+    };
+
+    mutex lock;
+    unsigned int capacity;              // Maximum number of entries
+    list<string> lru;                   // Keys, most recently used first
+    map<string, Entry> entries;
+    atomic<unsigned long> hit_count;
+    atomic<unsigned long> miss_count;
+};
+
+/*
+ * Builds a cache key from the algorithm, working width and divisor bits.
+ * Steps carry their costs, so the calling thread's cost model is part of
+ * the key.
+ */
+string cache_key(const char* algorithm, unsigned int width, const Binary& divisor) {
+  stringstream key;
+  key << algorithm << ':' << cost_model().name() << ':' << width << ':' << divisor.get_size() << ':'
+      << divisor.get_decimal() << ':' << divisor.char_val();
+  return key.str();
+}
+
+#endif
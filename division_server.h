@@ -0,0 +1,666 @@
+#ifndef DIVISION_SERVER_H
+#define DIVISION_SERVER_H
+
+#include "binary.h"
+#include "division_algorithms.h"
+#include "division_cache.h"
+#include "pipeline_scheduler.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cerrno>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const unsigned int SERVER_MAX_FRAME = 1 << 20;  // Largest accepted request
+static const unsigned int SERVER_MAX_WIDTH = 4096;     // Widest accepted operand
+static const unsigned int SERVER_CACHE_SIZE = 1024;
+static const unsigned int LATENCY_SUB_BUCKETS = 8;      // Histogram buckets per power of two
+static const unsigned int LATENCY_BUCKETS = 32 * LATENCY_SUB_BUCKETS;
+
+
+/*
+ * Reads exactly len bytes, returning false on EOF or error
+ */
+bool read_fully(int fd, char* buf, size_t len) {
+  while(len > 0) {
+    ssize_t got = read(fd, buf, len);
+    if(got < 0 && errno == EINTR) {
+      continue;
+    }
+    if(got <= 0) {
+      return false;
+    }
+    buf += got;
+    len -= got;
+  }
+  return true;
+}
+
+/*
+ * Writes exactly len bytes, returning false if the peer went away
+ */
+bool write_fully(int fd, const char* buf, size_t len) {
+  while(len > 0) {
+    ssize_t put = send(fd, buf, len, MSG_NOSIGNAL);
+    if(put < 0 && errno == EINTR) {
+      continue;
+    }
+    if(put <= 0) {
+      return false;
+    }
+    buf += put;
+    len -= put;
+  }
+  return true;
+}
+
+/**
+ * read_frame()
+ * @desc Reads one frame: a 4-byte big-endian length followed by the payload
+ * @param fd [in] socket to read from
+ * @param payload [out] the frame contents
+ * @return false on EOF, error or an oversized frame
+ */
+bool read_frame(int fd, string& payload) {
+  unsigned char header[4];
+  if(!read_fully(fd, reinterpret_cast<char*>(header), 4)) {
+    return false;
+  }
+
+  uint32_t len = (header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+  if(len > SERVER_MAX_FRAME) {
+    return false;
+  }
+
+  payload.resize(len);
+  return len == 0 || read_fully(fd, &payload[0], len);
+}
+
+/**
+ * write_frame()
+ * @desc Writes one frame: a 4-byte big-endian length followed by the payload
+ * @param fd [in] socket to write to
+ * @param payload [in] the frame contents
+ * @return false if the peer went away
+ */
+bool write_frame(int fd, const string& payload) {
+  uint32_t len = payload.size();
+  string frame(4, '\0');
+  frame[0] = (len >> 24) & 0xff;
+  frame[1] = (len >> 16) & 0xff;
+  frame[2] = (len >> 8) & 0xff;
+  frame[3] = len & 0xff;
+  frame += payload;
+  return write_fully(fd, frame.data(), frame.size());
+}
+
+/*
+ * Fills in a Unix domain socket address, throwing if the path doesn't fit
+ */
+sockaddr_un unix_address(const string& path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(path.size() >= sizeof(addr.sun_path)) {
+    throw "socket path too long";
+  }
+  strcpy(addr.sun_path, path.c_str());
+  return addr;
+}
+
+/*
+ * Compares unsigned bit strings of equal fraction length, ignoring leading 0's
+ */
+bool bits_less(const string& x, const string& y) {
+  size_t x_start = min(x.find('1'), x.size());
+  size_t y_start = min(y.find('1'), y.size());
+  if(x.size() - x_start != y.size() - y_start) {
+    return x.size() - x_start < y.size() - y_start;
+  }
+  return x.compare(x_start, string::npos, y, y_start, string::npos) < 0;
+}
+
+
+/**
+ * LatencyHistogram
+ * @desc Fixed-size log-linear histogram. Values below LATENCY_SUB_BUCKETS are
+ *       exact; above that each power of two is split into LATENCY_SUB_BUCKETS
+ *       buckets, so a percentile is within 1/8 of its true value however
+ *       many samples are recorded.
+ */
+struct LatencyHistogram {
+  unsigned long counts[LATENCY_BUCKETS];
+  unsigned long total;
+  unsigned int largest;
+
+  LatencyHistogram() : total(0), largest(0) {
+    fill(counts, counts + LATENCY_BUCKETS, 0);
+  }
+
+  /**
+   * record()
+   * @param value [in] sample to add
+   */
+  void record(unsigned int value) {
+    counts[bucket(value)]++;
+    total++;
+    largest = max(largest, value);
+  }
+
+  /**
+   * percentile()
+   * @param pct [in] percentile between 0 and 100
+   * @return upper bound of the bucket holding the nearest-rank percentile
+   */
+  unsigned int percentile(unsigned int pct) const {
+    if(total == 0) {
+      return 0;
+    }
+    unsigned long rank = max((pct * total + 99) / 100, 1UL);
+    unsigned long seen = 0;
+    unsigned int i = 0;
+    while(seen + counts[i] < rank) {
+      seen += counts[i++];
+    }
+    return min(upper_bound(i), largest);
+  }
+
+  private:
+
+    static unsigned int bucket(unsigned int value) {
+      if(value < LATENCY_SUB_BUCKETS) {
+        return value;
+      }
+      unsigned int shift = 0;
+      while((value >> shift) >= 2 * LATENCY_SUB_BUCKETS) {
+        shift++;
+      }
+      return (shift + 1) * LATENCY_SUB_BUCKETS + (value >> shift) - LATENCY_SUB_BUCKETS;
+    }
+
+    static unsigned int upper_bound(unsigned int index) {
+      if(index < LATENCY_SUB_BUCKETS) {
+        return index;
+      }
+      unsigned int shift = index / LATENCY_SUB_BUCKETS - 1;
+      unsigned long lower = static_cast<unsigned long>(LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) << shift;
+      return min(lower + (1UL << shift) - 1, static_cast<unsigned long>(UINT32_MAX));
+    }
+};
+
+
+/**
+ * ServerConnection
+ * @desc A client socket, closed once the reader and all pending responses are done
+ */
+struct ServerConnection {
+  int fd;
+  mutex write_lock;             // Responses from different batches may interleave
+
+  ServerConnection(int f) : fd(f) {}
+  ~ServerConnection() {
+    close(fd);
+  }
+};
+
+/**
+ * ServerRequest
+ * @desc A division request waiting to be batched
+ */
+struct ServerRequest {
+  shared_ptr<ServerConnection> connection;
+  string payload;
+  chrono::steady_clock::time_point arrival;
+  string sort_key;              // Groups requests with the same algorithm and divisor
+};
+
+
+/**
+ * DivisionServer
+ * @desc Serves framed division requests on a Unix domain socket.
+ *       Requests are text: "<id> <md|dr> <width> <dividend> <divisor>", with
+ *       operands as binary strings with one integer bit like "0.1101". Both
+ *       fractions are padded with 0's to width bits, or to the wider operand
+ *       if width is 0. The divisor must be below
+ *       1 and the quotient below 2; dr also needs the dividend below 1. Responses are "<id> <quotient> <cost>" or
+ *       "<id> error <reason>". "stats" and "shutdown" are answered directly;
+ *       requests arriving after a shutdown are answered with an error.
+ *       Requests are coalesced into batches of up to max_batch, or whatever
+ *       arrived within batch_wait of the oldest one. Each batch runs on a worker,
+ *       sorted so requests sharing a divisor hit the divisor cache back to back.
+ */
+class DivisionServer {
+  public:
+
+    /**
+     * DivisionServer Constructor
+     * @param p [in] socket path
+     * @param workers [in] number of threads processing batches
+     * @param batch [in] largest batch
+     * @param wait_us [in] how long the oldest request may wait for a batch to fill
+     */
+    DivisionServer(const string& p, unsigned int workers, unsigned int batch = 64,
+                   unsigned int wait_us = 200)
+      : path(p), pool(workers), cache(SERVER_CACHE_SIZE), max_batch(batch), batch_wait(wait_us) {
+      listen_fd = -1;
+      stopping = false;
+      in_flight = 0;
+      requests = 0;
+      batch_count = 0;
+      batched = 0;
+      largest_batch = 0;
+    }
+
+    ~DivisionServer() {
+      if(listen_fd >= 0) {
+        close(listen_fd);
+        unlink(path.c_str());
+      }
+    }
+
+    /**
+     * run()
+     * @desc Listens and serves until a client sends "shutdown"
+     */
+    void run() {
+      sockaddr_un addr = unix_address(path);
+      listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if(listen_fd < 0) {
+        throw "unable to create socket";
+      }
+      unlink(path.c_str());
+      if(bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+         listen(listen_fd, 64) < 0) {
+        throw "unable to listen on socket";
+      }
+
+      thread acceptor(&DivisionServer::accept_loop, this);
+      batch_loop();
+
+      // Wake the acceptor and readers, then wait for them
+      ::shutdown(listen_fd, SHUT_RDWR);
+      acceptor.join();
+      {
+        lock_guard<mutex> guard(connections_lock);
+        for(unsigned int i = 0; i < connections.size(); i++) {
+          shared_ptr<ServerConnection> conn = connections[i].lock();
+          if(conn) {
+            ::shutdown(conn->fd, SHUT_RD);
+          }
+        }
+      }
+      for(unsigned int i = 0; i < readers.size(); i++) {
+        readers[i].join();
+      }
+    }
+
+    /**
+     * stats()
+     * @return request count, batch sizes, latency percentiles and cache counters
+     */
+    string stats() {
+      lock_guard<mutex> guard(stats_lock);
+
+      stringstream out;
+      out << "Requests: " << requests << "  Batches: " << batch_count
+          << "  Mean batch: " << (batch_count == 0 ? 0 : static_cast<double>(batched) / batch_count)
+          << "  Max batch: " << largest_batch << endl
+          << "Latency us p50: " << latencies.percentile(50) << "  p90: " << latencies.percentile(90)
+          << "  p99: " << latencies.percentile(99)
+          << "  max: " << latencies.largest << endl
+          << "Divisor cache hits: " << cache.hits() << "  misses: " << cache.misses();
+      return out.str();
+    }
+
+  private:
+
+    /*
+     * Accepts clients until the listening socket is shut down
+     */
+    void accept_loop() {
+      while(true) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if(fd < 0) {
+          if(errno == EINTR) {
+            continue;
+          }
+          return;
+        }
+
+        shared_ptr<ServerConnection> conn = make_shared<ServerConnection>(fd);
+        {
+          lock_guard<mutex> guard(queue_lock);
+          if(stopping) {
+            return;
+          }
+        }
+        lock_guard<mutex> guard(connections_lock);
+        reap_readers();
+        connections.push_back(conn);
+        readers.push_back(thread(&DivisionServer::read_loop, this, conn));
+      }
+    }
+
+    /*
+     * Joins the readers whose clients have gone and forgets connections no
+     * longer in use. Call with connections_lock held.
+     */
+    void reap_readers() {
+      for(unsigned int i = 0; i < finished_readers.size(); i++) {
+        for(unsigned int j = 0; j < readers.size(); j++) {
+          if(readers[j].get_id() == finished_readers[i]) {
+            readers[j].join();
+            readers.erase(readers.begin() + j);
+            break;
+          }
+        }
+      }
+      finished_readers.clear();
+
+      connections.erase(remove_if(connections.begin(), connections.end(),
+                                  [](const weak_ptr<ServerConnection>& conn) { return conn.expired(); }),
+                        connections.end());
+    }
+
+    /*
+     * Queues one client's requests until it disconnects
+     */
+    void read_loop(shared_ptr<ServerConnection> conn) {
+      string payload;
+      while(read_frame(conn->fd, payload)) {
+        if(payload == "stats" || payload == "shutdown") {
+          string reply = payload == "stats" ? stats() : "ok";
+          {
+            lock_guard<mutex> guard(conn->write_lock);
+            write_frame(conn->fd, reply);
+          }
+          if(payload == "shutdown") {
+            lock_guard<mutex> guard(queue_lock);
+            stopping = true;
+            queue_ready.notify_all();
+          }
+          continue;
+        }
+
+        ServerRequest request;
+        request.connection = conn;
+        request.payload = payload;
+        request.arrival = chrono::steady_clock::now();
+
+        // "<id> <alg> <width> <dividend> <divisor>": sort on alg, width and divisor
+        stringstream fields(payload);
+        string id, alg, width, dividend, divisor;
+        fields >> id >> alg >> width >> dividend >> divisor;
+        request.sort_key = alg + " " + width + " " + divisor;
+
+        // batch_loop stops taking requests once stopping is set
+        {
+          lock_guard<mutex> guard(queue_lock);
+          if(!stopping) {
+            queue.push_back(request);
+            queue_ready.notify_all();
+            continue;
+          }
+        }
+        lock_guard<mutex> guard(conn->write_lock);
+        write_frame(conn->fd, id + " error shutting down");
+      }
+
+      // The acceptor joins this thread when the next client connects
+      lock_guard<mutex> guard(connections_lock);
+      finished_readers.push_back(this_thread::get_id());
+    }
+
+    /*
+     * Cuts the queue into batches and hands them to the workers
+     */
+    void batch_loop() {
+      while(true) {
+        vector<ServerRequest> batch;
+        {
+          unique_lock<mutex> guard(queue_lock);
+          while(queue.empty() && !stopping) {
+            queue_ready.wait(guard);
+          }
+          if(queue.empty()) {
+            break;
+          }
+
+          chrono::steady_clock::time_point deadline = queue.front().arrival + chrono::microseconds(batch_wait);
+          while(queue.size() < max_batch && !stopping &&
+                queue_ready.wait_until(guard, deadline) != cv_status::timeout) {
+          }
+
+          while(!queue.empty() && batch.size() < max_batch) {
+            batch.push_back(queue.front());
+            queue.pop_front();
+          }
+          in_flight++;
+        }
+
+        {
+          lock_guard<mutex> guard(stats_lock);
+          batch_count++;
+          batched += batch.size();
+          largest_batch = max(largest_batch, static_cast<unsigned int>(batch.size()));
+        }
+
+        shared_ptr<vector<ServerRequest> > work = make_shared<vector<ServerRequest> >(batch);
+        pool.submit([this, work]() {
+          process(*work);
+          lock_guard<mutex> guard(queue_lock);
+          in_flight--;
+          queue_ready.notify_all();
+        });
+      }
+
+      unique_lock<mutex> guard(queue_lock);
+      while(in_flight > 0) {
+        queue_ready.wait(guard);
+      }
+    }
+
+    /*
+     * Runs one batch and answers each request
+     */
+    void process(vector<ServerRequest>& batch) {
+      stable_sort(batch.begin(), batch.end(), [](const ServerRequest& x, const ServerRequest& y) {
+        return x.sort_key < y.sort_key;
+      });
+
+      for(unsigned int i = 0; i < batch.size(); i++) {
+        string reply = handle(batch[i].payload);
+
+        // Counted before the reply goes out, so a client that has every
+        // response sees them all in stats
+        unsigned int latency = chrono::duration_cast<chrono::microseconds>(
+          chrono::steady_clock::now() - batch[i].arrival).count();
+        {
+          lock_guard<mutex> guard(stats_lock);
+          latencies.record(latency);
+          requests++;
+        }
+
+        lock_guard<mutex> guard(batch[i].connection->write_lock);
+        write_frame(batch[i].connection->fd, reply);
+      }
+    }
+
+    /*
+     * Parses and performs one division request
+     */
+    string handle(const string& payload) {
+      stringstream fields(payload);
+      string id, alg, dividend_str, divisor_str;
+      unsigned int width = 0;
+
+      if(!(fields >> id >> alg >> width >> dividend_str >> divisor_str)) {
+        return id + " error malformed request";
+      }
+      if((alg != "md" && alg != "dr") || width > SERVER_MAX_WIDTH ||
+         !fraction_string(dividend_str) || !fraction_string(divisor_str)) {
+        return id + " error invalid request";
+      }
+      if(width > 0 && (width < dividend_str.size() - 1 || width < divisor_str.size() - 1)) {
+        return id + " error operand wider than width";
+      }
+      if(divisor_str.find('1') == string::npos) {
+        return id + " error division by zero";
+      }
+      if(divisor_str[0] == '1') {
+        return id + " error divisor must be below 1";
+      }
+      if(alg == "dr" && dividend_str[0] == '1') {
+        return id + " error dr needs a dividend below 1";
+      }
+
+      // The quotient has one integer bit, so the dividend must be below twice
+      // the divisor. Both sides are compared as integers over the longer
+      // fraction.
+      string a_bits = dividend_str.substr(0, 1) + dividend_str.substr(2);
+      string b2_bits = divisor_str.substr(2);
+      size_t fraction = max(a_bits.size() - 1, b2_bits.size() - 1);
+      a_bits.append(fraction - (a_bits.size() - 1), '0');
+      b2_bits.append(fraction - (b2_bits.size() - 1), '0');
+      if(!bits_less(a_bits, b2_bits)) {
+        return id + " error quotient overflows";
+      }
+
+      // The algorithms work at the dividend's width, so both operands share one
+      if(width == 0) {
+        width = max(dividend_str.size(), divisor_str.size()) - 1;
+      }
+      dividend_str.append(width + 1 - dividend_str.size(), '0');
+      divisor_str.append(width + 1 - divisor_str.size(), '0');
+      Binary dividend(dividend_str.size() - 1);
+      Binary divisor(divisor_str.size() - 1);
+      dividend = dividend_str.c_str();
+      divisor = divisor_str.c_str();
+
+      unsigned int cost = 0;
+      Binary quotient;
+      if(alg == "md") {
+        quotient = multiplicative_division(dividend, divisor, cost, NULL, &cache);
+      }
+      else {
+        quotient = divisor_reciprocation(dividend, divisor, cost, NULL, &cache);
+      }
+
+      stringstream reply;
+      reply << id << " " << quotient.char_val() << " " << cost;
+      return reply.str();
+    }
+
+    /*
+     * True for "<0|1>.<bits>" no wider than SERVER_MAX_WIDTH
+     */
+    static bool fraction_string(const string& operand) {
+      return operand.size() >= 3 && operand.size() <= SERVER_MAX_WIDTH + 1 && operand[1] == '.' &&
+             (operand[0] == '0' || operand[0] == '1') &&
+             operand.find_first_not_of("01", 2) == string::npos;
+    }
+
+    string path;
+    int listen_fd;
+    ThreadPool pool;
+    DivisionCache cache;
+    unsigned int max_batch;
+    unsigned int batch_wait;            // Microseconds
+
+    mutex queue_lock;                   // Guards queue, stopping and in_flight
+    condition_variable queue_ready;
+    deque<ServerRequest> queue;
+    bool stopping;
+    unsigned int in_flight;             // Batches handed to the pool but not finished
+
+    mutex connections_lock;             // Guards connections, readers and finished_readers
+    vector<weak_ptr<ServerConnection> > connections;
+    vector<thread> readers;
+    vector<thread::id> finished_readers; // Readers that returned but aren't joined yet
+
+    mutex stats_lock;
+    unsigned long requests;
+    LatencyHistogram latencies;         // Microseconds from arrival to response
+    unsigned long batch_count;
+    unsigned long batched;              // Requests over all batches
+    unsigned int largest_batch;
+};
+
+
+/**
+ * DivisionClient
+ * @desc Local client for DivisionServer. Requests can be pipelined: send
+ *       several, then receive the responses.
+ */
+class DivisionClient {
+  public:
+
+    /**
+     * DivisionClient Constructor
+     * @param path [in] socket path the server listens on
+     */
+    DivisionClient(const string& path) {
+      sockaddr_un addr = unix_address(path);
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if(fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        if(fd >= 0) {
+          close(fd);
+        }
+        throw "unable to connect to server";
+      }
+    }
+
+    ~DivisionClient() {
+      close(fd);
+    }
+
+    /**
+     * send()
+     * @param payload [in] request to send
+     */
+    void send(const string& payload) {
+      if(!write_frame(fd, payload)) {
+        throw "server closed the connection";
+      }
+    }
+
+    /**
+     * receive()
+     * @return the next response
+     */
+    string receive() {
+      string payload;
+      if(!read_frame(fd, payload)) {
+        throw "server closed the connection";
+      }
+      return payload;
+    }
+
+    /**
+     * request()
+     * @param payload [in] request to send
+     * @return its response
+     */
+    string request(const string& payload) {
+      send(payload);
+      return receive();
+    }
+
+  private:
+    int fd;
+};
+
+#endif
@@ -0,0 +1,430 @@
+#ifndef IEEE754_H
+#define IEEE754_H
+
+#include "binary.h"
+#include "division_algorithms.h"
+#include "thread_pool.h"
+#include <cfenv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <random>
+
+using namespace std;
+
+static const unsigned int IEEE_GUARD_BITS = 8; // Extra quotient bits below the significand
+
+
+/**
+ * IEEEFormat
+ * @desc Field widths of an IEEE 754 binary interchange format
+ */
+struct IEEEFormat {
+  unsigned int fraction_bits;   // Stored significand bits (without the hidden bit)
+  unsigned int exponent_bits;
+};
+
+static const IEEEFormat BINARY32 = {23, 8};
+static const IEEEFormat BINARY64 = {52, 11};
+
+/**
+ * RoundingMode
+ * @desc The four IEEE 754 rounding direction attributes
+ */
+enum RoundingMode {
+  ROUND_NEAREST_EVEN,
+  ROUND_TOWARD_ZERO,
+  ROUND_UPWARD,
+  ROUND_DOWNWARD
+};
+
+
+/*
+ * Value of a non-negative Binary scaled by 2^frac, truncated to an integer
+ */
+unsigned __int128 binary_to_fixed(const Binary& val, int frac) {
+  unsigned __int128 ret = 0;
+  for(int i = 0; i < static_cast<int>(val.get_size()); i++) {
+    int pos = i - val.get_decimal() + frac;
+    if(val.get_digit(i) && pos >= 0 && pos < 128) {
+      ret |= static_cast<unsigned __int128>(1) << pos;
+    }
+  }
+  return ret;
+}
+
+/*
+ * Rounded result for a quotient too large for the format
+ */
+uint64_t ieee_overflow(uint64_t sign, const IEEEFormat& fmt, RoundingMode mode) {
+  uint64_t exp_mask = (static_cast<uint64_t>(1) << fmt.exponent_bits) - 1;
+  uint64_t inf = exp_mask << fmt.fraction_bits;
+  uint64_t sign_bit = sign << (fmt.fraction_bits + fmt.exponent_bits);
+
+  bool to_inf = mode == ROUND_NEAREST_EVEN ||
+                (mode == ROUND_UPWARD && !sign) ||
+                (mode == ROUND_DOWNWARD && sign);
+  return sign_bit | (to_inf ? inf : inf - 1);
+}
+
+
+/**
+ * Performs a / b = ? on IEEE 754 encodings, with the significands divided
+ * by one of the simulated dividers
+ * @desc Specials are handled up front and subnormals are normalized. The
+ *       simulated quotient is then fixed up by one remainder-based correction
+ *       step, as in a hardware divider, and rounded under the given mode.
+ * @param a [in] Left hand side encoding
+ * @param b [in] Right hand side encoding
+ * @param fmt [in] Format of a, b and the result
+ * @param algorithm [in] MULTIPLICATIVE_DIVISION or DIVISOR_RECIPROCATION
+ * @param mode [in] Rounding mode
+ * @param cost [in/out] Cost to perform operation
+ * @param estimate_error [out] If not NULL, distance in ulps between the simulated and exact truncated quotient
+ * @return encoding of the rounded quotient
+ */
+uint64_t ieee_divide_bits(uint64_t a, uint64_t b, const IEEEFormat& fmt, Algorithm algorithm,
+                          RoundingMode mode, unsigned int& cost,
+                          unsigned int* estimate_error = NULL) {
+  unsigned int fbits = fmt.fraction_bits;
+  unsigned int p = fbits + 1;
+  uint64_t frac_mask = (static_cast<uint64_t>(1) << fbits) - 1;
+  uint64_t exp_mask = (static_cast<uint64_t>(1) << fmt.exponent_bits) - 1;
+  uint64_t quiet = static_cast<uint64_t>(1) << (fbits - 1);
+  uint64_t inf = exp_mask << fbits;
+  int bias = (1 << (fmt.exponent_bits - 1)) - 1;
+
+  uint64_t sign = ((a ^ b) >> (fbits + fmt.exponent_bits)) & 1;
+  uint64_t sign_bit = sign << (fbits + fmt.exponent_bits);
+
+  uint64_t ea = (a >> fbits) & exp_mask, fa = a & frac_mask;
+  uint64_t eb = (b >> fbits) & exp_mask, fb = b & frac_mask;
+
+  bool a_nan = ea == exp_mask && fa != 0, b_nan = eb == exp_mask && fb != 0;
+  bool a_inf = ea == exp_mask && fa == 0, b_inf = eb == exp_mask && fb == 0;
+  bool a_zero = ea == 0 && fa == 0, b_zero = eb == 0 && fb == 0;
+
+  if(estimate_error != NULL) {
+    *estimate_error = 0;
+  }
+
+  // Specials: NaNs propagate quieted, invalid operations give the default NaN
+  if(a_nan || b_nan) {
+    return (a_nan ? a : b) | quiet;
+  }
+  if((a_inf && b_inf) || (a_zero && b_zero)) {
+    return (static_cast<uint64_t>(1) << (fbits + fmt.exponent_bits)) | inf | quiet;
+  }
+  if(a_inf || b_zero) {
+    return sign_bit | inf;
+  }
+  if(a_zero || b_inf) {
+    return sign_bit;
+  }
+
+  // Unpack, giving subnormals a hidden bit by normalizing them
+  uint64_t ma = ea != 0 ? (fa | (frac_mask + 1)) : fa;
+  uint64_t mb = eb != 0 ? (fb | (frac_mask + 1)) : fb;
+  int exp_a = ea != 0 ? ea : 1;
+  int exp_b = eb != 0 ? eb : 1;
+  while((ma >> fbits) == 0) {
+    ma <<= 1;
+    exp_a--;
+  }
+  while((mb >> fbits) == 0) {
+    mb <<= 1;
+    exp_b--;
+  }
+
+  // Run the significands, as fractions in [0.5, 1), through the simulated divider
+  int width = p + IEEE_GUARD_BITS + 1;
+  Binary sig_a(width), sig_b(width);
+  for(int i = 0; i < width; i++) {
+    int bit = i - (width - 1 - p);
+    sig_a.set_digit(i, bit >= 0 && ((ma >> bit) & 1));
+    sig_b.set_digit(i, bit >= 0 && ((mb >> bit) & 1));
+  }
+  sig_a.set_decimal(width - 1);
+  sig_b.set_decimal(width - 1);
+
+  // The first factor is ~1, then every iteration doubles the correct bits
+  int iterlimit = 2;
+  for(int bits = 1; bits < width; bits *= 2) {
+    iterlimit++;
+  }
+
+  Binary q_sim;
+  if(algorithm == MULTIPLICATIVE_DIVISION) {
+    q_sim = multiplicative_division(sig_a, sig_b, cost, NULL, NULL, iterlimit);
+  }
+  else if(algorithm == DIVISOR_RECIPROCATION) {
+    q_sim = divisor_reciprocation(sig_a, sig_b, cost, NULL, NULL, iterlimit);
+  }
+  else {
+    throw "ieee_divide_bits only supports the division algorithms";
+  }
+
+  // Quotient in [1, 2) keeps the exponent, in (0.5, 1) it borrows one
+  int exp = exp_a - exp_b + bias;
+  int k = p - 1;
+  if(ma < mb) {
+    exp--;
+    k++;
+  }
+  if(exp >= static_cast<int>(exp_mask)) {
+    return ieee_overflow(sign, fmt, mode);
+  }
+
+  // Subnormal results keep fewer significand bits
+  if(exp <= 0) {
+    k -= min(1 - exp, static_cast<int>(p) + 1);
+    exp = 0;
+  }
+
+  // T = floor(ma / mb * 2^k), estimated from the simulated quotient
+  unsigned __int128 num = static_cast<unsigned __int128>(ma) << max(k, 0);
+  unsigned __int128 den = static_cast<unsigned __int128>(mb) << max(-k, 0);
+  __int128 t = binary_to_fixed(q_sim, k);
+
+  __int128 exact = num / den;
+  if(estimate_error != NULL) {
+    *estimate_error = static_cast<unsigned int>(t > exact ? t - exact : exact - t);
+  }
+
+  // One correction step from the sign and size of the remainder
+  __int128 rem = static_cast<__int128>(num) - t * static_cast<__int128>(den);
+  if(rem < 0) {
+    t--;
+    rem += den;
+  }
+  else if(rem >= static_cast<__int128>(den)) {
+    t++;
+    rem -= den;
+  }
+
+  bool round_up = false;
+  if(mode == ROUND_NEAREST_EVEN) {
+    round_up = 2 * rem > static_cast<__int128>(den) || (2 * rem == static_cast<__int128>(den) && (t & 1));
+  }
+  else if(mode == ROUND_UPWARD) {
+    round_up = rem != 0 && !sign;
+  }
+  else if(mode == ROUND_DOWNWARD) {
+    round_up = rem != 0 && sign;
+  }
+  t += round_up;
+
+  // The hidden bit (or a rounding carry out of it) lands in the exponent field
+  uint64_t bits = static_cast<uint64_t>(t);
+  if(exp > 0) {
+    bits += static_cast<uint64_t>(exp - 1) << fbits;
+  }
+  if((bits >> fbits) >= exp_mask) {
+    return ieee_overflow(sign, fmt, mode);
+  }
+
+  return sign_bit | bits;
+}
+
+
+/**
+ * Performs a / b = ? on binary32 operands using a simulated divider
+ * @param a [in] Left hand side
+ * @param b [in] Right hand side
+ * @param algorithm [in] MULTIPLICATIVE_DIVISION or DIVISOR_RECIPROCATION
+ * @param mode [in] Rounding mode
+ * @param cost [in/out] Cost to perform operation
+ * @return the rounded quotient
+ */
+float ieee_divide(float a, float b, Algorithm algorithm, RoundingMode mode, unsigned int& cost) {
+  uint32_t a_bits, b_bits, q_bits;
+  memcpy(&a_bits, &a, sizeof(a));
+  memcpy(&b_bits, &b, sizeof(b));
+
+  q_bits = ieee_divide_bits(a_bits, b_bits, BINARY32, algorithm, mode, cost);
+
+  float q;
+  memcpy(&q, &q_bits, sizeof(q));
+  return q;
+}
+
+/**
+ * Performs a / b = ? on binary64 operands using a simulated divider
+ * @param a [in] Left hand side
+ * @param b [in] Right hand side
+ * @param algorithm [in] MULTIPLICATIVE_DIVISION or DIVISOR_RECIPROCATION
+ * @param mode [in] Rounding mode
+ * @param cost [in/out] Cost to perform operation
+ * @return the rounded quotient
+ */
+double ieee_divide(double a, double b, Algorithm algorithm, RoundingMode mode, unsigned int& cost) {
+  uint64_t a_bits, b_bits, q_bits;
+  memcpy(&a_bits, &a, sizeof(a));
+  memcpy(&b_bits, &b, sizeof(b));
+
+  q_bits = ieee_divide_bits(a_bits, b_bits, BINARY64, algorithm, mode, cost);
+
+  double q;
+  memcpy(&q, &q_bits, sizeof(q));
+  return q;
+}
+
+
+/**
+ * IEEEVerifyReport
+ * @desc Results of checking the front-end against hardware division
+ */
+struct IEEEVerifyReport {
+  unsigned long count;
+  unsigned long mismatches;
+  unsigned long estimate_failures;      // Simulated quotient more than 1 ulp off
+  unsigned int max_estimate_error;      // In ulps of the truncated quotient
+  double seconds;
+  uint64_t first_a, first_b;            // Operands of the first mismatch
+  uint64_t first_expected, first_actual;
+};
+
+/*
+ * Hardware quotient of two encodings under a rounding mode
+ */
+uint64_t hardware_divide_bits(uint64_t a, uint64_t b, const IEEEFormat& fmt, RoundingMode mode) {
+  static const int FE_MODES[] = {FE_TONEAREST, FE_TOWARDZERO, FE_UPWARD, FE_DOWNWARD};
+  int saved = fegetround();
+  fesetround(FE_MODES[mode]);
+
+  uint64_t ret;
+  if(fmt.fraction_bits == BINARY32.fraction_bits) {
+    uint32_t a32 = a, b32 = b, q32;
+    float x, y;
+    memcpy(&x, &a32, sizeof(x));
+    memcpy(&y, &b32, sizeof(y));
+    volatile float q = x / y;
+    float q_val = q;
+    memcpy(&q32, &q_val, sizeof(q32));
+    ret = q32;
+  }
+  else {
+    double x, y;
+    memcpy(&x, &a, sizeof(x));
+    memcpy(&y, &b, sizeof(y));
+    volatile double q = x / y;
+    double q_val = q;
+    memcpy(&ret, &q_val, sizeof(ret));
+  }
+
+  fesetround(saved);
+  return ret;
+}
+
+/*
+ * Random operand encoding: mostly normal numbers near each other in
+ * magnitude, with raw bit patterns mixed in for specials and subnormals
+ */
+uint64_t random_operand(mt19937_64& rng, const IEEEFormat& fmt) {
+  unsigned int total = fmt.fraction_bits + fmt.exponent_bits + 1;
+  uint64_t mask = total == 64 ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << total) - 1;
+  uint64_t raw = rng() & mask;
+
+  if(rng() % 8 == 0) {
+    return raw;
+  }
+
+  uint64_t bias = (static_cast<uint64_t>(1) << (fmt.exponent_bits - 1)) - 1;
+  uint64_t exp = bias - 8 + rng() % 16;
+  uint64_t frac = raw & ((static_cast<uint64_t>(1) << fmt.fraction_bits) - 1);
+  uint64_t sign = raw >> (total - 1);
+  return (sign << (total - 1)) | (exp << fmt.fraction_bits) | frac;
+}
+
+/**
+ * Checks count random divisions against the hardware divider
+ * @param count [in] number of divisions
+ * @param fmt [in] BINARY32 or BINARY64
+ * @param algorithm [in] simulated divider to check
+ * @param mode [in] rounding mode
+ * @param pool [in] threads to spread the divisions across
+ * @param seed [in] random seed, so failures can be reproduced
+ * @return mismatch and accuracy statistics
+ */
+IEEEVerifyReport ieee_verify(unsigned long count, const IEEEFormat& fmt, Algorithm algorithm,
+                             RoundingMode mode, ThreadPool& pool, unsigned long seed = 1) {
+  IEEEVerifyReport report;
+  memset(&report, 0, sizeof(report));
+  report.count = count;
+
+  mutex merge;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  // Chunks are seeded by index, so the operands don't depend on the thread count
+  static const unsigned long CHUNK = 1024;
+  unsigned int chunks = (count + CHUNK - 1) / CHUNK;
+  pool.parallel_for(0, chunks, [&](unsigned int lo, unsigned int hi) {
+    IEEEVerifyReport local;
+    memset(&local, 0, sizeof(local));
+
+    for(unsigned int c = lo; c < hi; c++) {
+      mt19937_64 rng(seed * 1000003 + c);
+      for(unsigned long i = c * CHUNK; i < count && i < (c + 1) * CHUNK; i++) {
+        uint64_t a = random_operand(rng, fmt);
+        uint64_t b = random_operand(rng, fmt);
+
+        unsigned int cost = 0, estimate_error = 0;
+        uint64_t actual = ieee_divide_bits(a, b, fmt, algorithm, mode, cost, &estimate_error);
+        uint64_t expected = hardware_divide_bits(a, b, fmt, mode);
+
+        local.max_estimate_error = max(local.max_estimate_error, estimate_error);
+        if(estimate_error > 1) {
+          local.estimate_failures++;
+        }
+
+        // Any NaN matches any NaN: payloads are implementation defined
+        uint64_t exp_mask = ((static_cast<uint64_t>(1) << fmt.exponent_bits) - 1) << fmt.fraction_bits;
+        uint64_t frac_mask = (static_cast<uint64_t>(1) << fmt.fraction_bits) - 1;
+        bool nan_actual = (actual & exp_mask) == exp_mask && (actual & frac_mask) != 0;
+        bool nan_expected = (expected & exp_mask) == exp_mask && (expected & frac_mask) != 0;
+
+        if(nan_actual != nan_expected || (!nan_actual && actual != expected)) {
+          if(local.mismatches == 0) {
+            local.first_a = a;
+            local.first_b = b;
+            local.first_expected = expected;
+            local.first_actual = actual;
+          }
+          local.mismatches++;
+        }
+      }
+    }
+
+    lock_guard<mutex> guard(merge);
+    if(report.mismatches == 0 && local.mismatches > 0) {
+      report.first_a = local.first_a;
+      report.first_b = local.first_b;
+      report.first_expected = local.first_expected;
+      report.first_actual = local.first_actual;
+    }
+    report.mismatches += local.mismatches;
+    report.estimate_failures += local.estimate_failures;
+    report.max_estimate_error = max(report.max_estimate_error, local.max_estimate_error);
+  });
+
+  report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  return report;
+}
+
+/*
+ * ostream insertion operator for the verification report
+ */
+ostream& operator <<(ostream &os, const IEEEVerifyReport &report) {
+  os << "Checked: " << report.count << "  Mismatches: " << report.mismatches
+     << "  Estimate failures: " << report.estimate_failures
+     << "  Max estimate error: " << report.max_estimate_error << " ulp"
+     << "  Rate: " << (report.seconds > 0 ? report.count / report.seconds : 0) << " div/s";
+  if(report.mismatches > 0) {
+    os << endl << hex << "First mismatch: " << report.first_a << " / " << report.first_b
+       << " expected " << report.first_expected << " got " << report.first_actual << dec;
+  }
+  return os;
+}
+
+#endif
@@ -0,0 +1,674 @@
+#ifndef NETLIST_H
+#define NETLIST_H
+
+#include "binary.h"
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const unsigned int MEASURE_ROUNDS = 16; // Random input transitions per measurement
+
+
+/**
+ * GateKind
+ * @desc Primitives a netlist is built from. Every gate has unit delay.
+ */
+enum GateKind {
+  GATE_INPUT,
+  GATE_CONST0,
+  GATE_CONST1,
+  GATE_NOT,
+  GATE_AND,
+  GATE_OR,
+  GATE_XOR
+};
+
+/**
+ * NetlistKind
+ * @desc The circuits behind add(), mul() and complement()
+ */
+enum NetlistKind {
+  NET_ADDER,                    // Kogge-Stone adder, as in kogge_stone()
+  NET_MULTIPLIER,               // Partial products summed by a tree of Kogge-Stone adders, as in mul()
+  NET_ARRAY_MULTIPLIER,         // Partial products accumulated row by row in carry-save form
+  NET_COMPLEMENT                // Inverters and a ripple incrementer, as in complement()
+};
+
+/**
+ * Gate
+ * @desc One gate. Its output is the net with the gate's index.
+ */
+struct Gate {
+  GateKind kind;
+  unsigned int lhs;             // Input nets (unused ones are 0)
+  unsigned int rhs;
+};
+
+
+/**
+ * Netlist
+ * @desc Gates in topological order: a gate only reads nets created before it
+ */
+class Netlist {
+  public:
+
+    /**
+     * Netlist Constructor
+     * @param n [in] name written in the netlist header
+     */
+    Netlist(const string& n) : name(n) {
+      const0 = gate(GATE_CONST0);
+      const1 = gate(GATE_CONST1);
+    }
+
+    /**
+     * input()
+     * @param n [in] name of the input
+     * @return the input's net
+     */
+    unsigned int input(const string& n) {
+      unsigned int net = gate(GATE_INPUT);
+      inputs.push_back(net);
+      names[net] = n;
+      return net;
+    }
+
+    /**
+     * gate()
+     * @param kind [in] gate type
+     * @param lhs [in] first input net
+     * @param rhs [in] second input net
+     * @return the gate's output net
+     */
+    unsigned int gate(GateKind kind, unsigned int lhs = 0, unsigned int rhs = 0) {
+      Gate g;
+      g.kind = kind;
+      g.lhs = lhs;
+      g.rhs = rhs;
+      gates.push_back(g);
+      return gates.size() - 1;
+    }
+
+    /**
+     * constant()
+     * @param value [in] the constant
+     * @return the net tied to it
+     */
+    unsigned int constant(bool value) const {
+      return value ? const1 : const0;
+    }
+
+    /**
+     * output()
+     * @param net [in] net to expose
+     * @param n [in] name of the output
+     */
+    void output(unsigned int net, const string& n) {
+      outputs.push_back(net);
+      output_names.push_back(n);
+    }
+
+    const vector<Gate>& get_gates() const {
+      return gates;
+    }
+
+    const vector<unsigned int>& get_inputs() const {
+      return inputs;
+    }
+
+    const vector<unsigned int>& get_outputs() const {
+      return outputs;
+    }
+
+    /**
+     * depth()
+     * @return gate levels on the longest path from an input to an output
+     */
+    unsigned int depth() const {
+      vector<unsigned int> level(gates.size(), 0);
+      for(unsigned int i = 0; i < gates.size(); i++) {
+        switch(gates[i].kind) {
+          case GATE_INPUT: case GATE_CONST0: case GATE_CONST1:
+            break;
+          case GATE_NOT:
+            level[i] = level[gates[i].lhs] + 1;
+            break;
+          default:
+            level[i] = max(level[gates[i].lhs], level[gates[i].rhs]) + 1;
+        }
+      }
+
+      unsigned int ret = 0;
+      for(unsigned int i = 0; i < outputs.size(); i++) {
+        ret = max(ret, level[outputs[i]]);
+      }
+      return ret;
+    }
+
+    /**
+     * Writes the netlist as text, one gate per line
+     */
+    friend ostream& operator<<(ostream& os, const Netlist& net) {
+      const char* KINDS[] = {"input", "const0", "const1", "not", "and", "or", "xor"};
+
+      os << "netlist " << net.name << endl;
+      for(unsigned int i = 0; i < net.inputs.size(); i++) {
+        os << "input " << net.net_name(net.inputs[i]) << endl;
+      }
+      for(unsigned int i = 0; i < net.gates.size(); i++) {
+        const Gate& g = net.gates[i];
+        if(g.kind == GATE_INPUT) {
+          continue;
+        }
+        os << net.net_name(i) << " = " << KINDS[g.kind];
+        if(g.kind >= GATE_NOT) {
+          os << " " << net.net_name(g.lhs);
+        }
+        if(g.kind > GATE_NOT) {
+          os << " " << net.net_name(g.rhs);
+        }
+        os << endl;
+      }
+      for(unsigned int i = 0; i < net.outputs.size(); i++) {
+        os << "output " << net.output_names[i] << " = " << net.net_name(net.outputs[i]) << endl;
+      }
+      return os;
+    }
+
+  private:
+
+    /*
+     * Inputs keep their own names, gates are n<index>
+     */
+    string net_name(unsigned int net) const {
+      map<unsigned int, string>::const_iterator it = names.find(net);
+      if(it != names.end()) {
+        return it->second;
+      }
+      stringstream os;
+      os << "n" << net;
+      return os.str();
+    }
+
+    string name;
+    vector<Gate> gates;
+    vector<unsigned int> inputs;
+    vector<unsigned int> outputs;
+    vector<string> output_names;
+    map<unsigned int, string> names;
+    unsigned int const0, const1;
+};
+
+
+/**
+ * NetlistSimulator
+ * @desc Event-driven unit-delay simulator. Every net holds one word, so 64
+ *       independent input vectors are simulated at once, one per bit lane.
+ *       Only gates whose inputs changed on the previous time step are
+ *       evaluated.
+ */
+class NetlistSimulator {
+  public:
+
+    /**
+     * NetlistSimulator Constructor
+     * @param n [in] netlist to simulate, which must outlive the simulator
+     */
+    NetlistSimulator(const Netlist& n) : net(n), values(n.get_gates().size(), 0),
+                                         fanout(n.get_gates().size()), scheduled(n.get_gates().size(), 0),
+                                         is_output(n.get_gates().size(), false) {
+      const vector<Gate>& gates = net.get_gates();
+      for(unsigned int i = 0; i < gates.size(); i++) {
+        if(gates[i].kind >= GATE_NOT) {
+          fanout[gates[i].lhs].push_back(i);
+        }
+        if(gates[i].kind > GATE_NOT && gates[i].rhs != gates[i].lhs) {
+          fanout[gates[i].rhs].push_back(i);
+        }
+      }
+      for(unsigned int i = 0; i < net.get_outputs().size(); i++) {
+        is_output[net.get_outputs()[i]] = true;
+      }
+      stamp = 0;
+    }
+
+    /**
+     * settle()
+     * @desc Applies input words and evaluates every gate, without timing
+     * @param in [in] one word per netlist input
+     */
+    void settle(const vector<word_t>& in) {
+      const vector<Gate>& gates = net.get_gates();
+      for(unsigned int i = 0; i < net.get_inputs().size(); i++) {
+        values[net.get_inputs()[i]] = in[i];
+      }
+      for(unsigned int i = 0; i < gates.size(); i++) {
+        if(gates[i].kind != GATE_INPUT) {
+          values[i] = evaluate(gates[i]);
+        }
+      }
+    }
+
+    /**
+     * apply()
+     * @desc Changes the inputs of a settled netlist and propagates the events
+     * @param in [in] one word per netlist input
+     * @return time step of the last output event in any lane
+     */
+    unsigned int apply(const vector<word_t>& in) {
+      vector<unsigned int> pending;
+      stamp++;
+      for(unsigned int i = 0; i < net.get_inputs().size(); i++) {
+        unsigned int input = net.get_inputs()[i];
+        if(values[input] != in[i]) {
+          values[input] = in[i];
+          schedule_fanout(input, pending);
+        }
+      }
+
+      const vector<Gate>& gates = net.get_gates();
+      unsigned int last = 0;
+      vector<pair<unsigned int, word_t> > changes;
+      for(unsigned int time = 1; !pending.empty(); time++) {
+        // Every pending gate sees the values from the previous step
+        changes.clear();
+        for(unsigned int i = 0; i < pending.size(); i++) {
+          word_t value = evaluate(gates[pending[i]]);
+          if(value != values[pending[i]]) {
+            changes.push_back(make_pair(pending[i], value));
+          }
+        }
+
+        pending.clear();
+        stamp++;
+        for(unsigned int i = 0; i < changes.size(); i++) {
+          values[changes[i].first] = changes[i].second;
+          if(is_output[changes[i].first]) {
+            last = time;
+          }
+          schedule_fanout(changes[i].first, pending);
+        }
+      }
+      return last;
+    }
+
+    /**
+     * value()
+     * @param net_index [in] net to read
+     * @return the net's current word
+     */
+    word_t value(unsigned int net_index) const {
+      return values[net_index];
+    }
+
+  private:
+
+    word_t evaluate(const Gate& g) const {
+      switch(g.kind) {
+        case GATE_CONST0: return 0;
+        case GATE_CONST1: return ~static_cast<word_t>(0);
+        case GATE_NOT:    return ~values[g.lhs];
+        case GATE_AND:    return values[g.lhs] & values[g.rhs];
+        case GATE_OR:     return values[g.lhs] | values[g.rhs];
+        case GATE_XOR:    return values[g.lhs] ^ values[g.rhs];
+        default:          return 0;
+      }
+    }
+
+    void schedule_fanout(unsigned int changed, vector<unsigned int>& pending) {
+      for(unsigned int i = 0; i < fanout[changed].size(); i++) {
+        unsigned int g = fanout[changed][i];
+        if(scheduled[g] != stamp) {
+          scheduled[g] = stamp;
+          pending.push_back(g);
+        }
+      }
+    }
+
+    const Netlist& net;
+    vector<word_t> values;
+    vector<vector<unsigned int> > fanout;
+    vector<unsigned int> scheduled;     // Time step stamp, so a gate is queued once per step
+    vector<bool> is_output;
+    unsigned int stamp;
+};
+
+
+/**
+ * kogge_stone_gates()
+ * @desc Adds the gates of a Kogge-Stone adder, level for level as kogge_stone()
+ * @param net [in/out] netlist to add to
+ * @param lhs [in] nets of the left hand side, LSB first
+ * @param rhs [in] nets of the right hand side, LSB first
+ * @return nets of the sum, LSB first
+ */
+vector<unsigned int> kogge_stone_gates(Netlist& net, const vector<unsigned int>& lhs,
+                                       const vector<unsigned int>& rhs) {
+  unsigned int width = lhs.size();
+  vector<unsigned int> g(width), p(width), half_sum(width);
+
+  for(unsigned int i = 0; i < width; i++) {
+    g[i] = net.gate(GATE_AND, lhs[i], rhs[i]);
+    p[i] = net.gate(GATE_XOR, lhs[i], rhs[i]);
+    half_sum[i] = p[i];
+  }
+
+  // Groups that already reach bit 0 pass through unchanged
+  for(unsigned int span = 1; span < width; span *= 2) {
+    vector<unsigned int> g_next = g, p_next = p;
+    for(unsigned int i = span; i < width; i++) {
+      g_next[i] = net.gate(GATE_OR, g[i], net.gate(GATE_AND, p[i], g[i - span]));
+      if(i >= 2 * span) {
+        p_next[i] = net.gate(GATE_AND, p[i], p[i - span]);
+      }
+    }
+    g.swap(g_next);
+    p.swap(p_next);
+  }
+
+  // Carry into bit i is the group generate of bits [0, i)
+  vector<unsigned int> sum(width);
+  for(unsigned int i = 0; i < width; i++) {
+    sum[i] = i == 0 ? half_sum[0] : net.gate(GATE_XOR, half_sum[i], g[i - 1]);
+  }
+  return sum;
+}
+
+/**
+ * carry_save_gates()
+ * @desc Adds a row of full adders reducing three operands to a sum and a carry
+ * @param net [in/out] netlist to add to
+ * @param x [in] nets of the first operand, LSB first
+ * @param y [in] nets of the second operand, LSB first
+ * @param z [in] nets of the third operand, LSB first
+ * @param sum [out] nets of the sum bits
+ * @param carry [out] nets of the carry bits, already shifted up one place
+ */
+void carry_save_gates(Netlist& net, const vector<unsigned int>& x, const vector<unsigned int>& y,
+                      const vector<unsigned int>& z, vector<unsigned int>& sum,
+                      vector<unsigned int>& carry) {
+  unsigned int width = x.size();
+  sum.resize(width);
+  carry.assign(width, net.constant(false));
+  for(unsigned int i = 0; i < width; i++) {
+    unsigned int half = net.gate(GATE_XOR, x[i], y[i]);
+    sum[i] = net.gate(GATE_XOR, half, z[i]);
+    if(i + 1 < width) {
+      carry[i + 1] = net.gate(GATE_OR, net.gate(GATE_AND, x[i], y[i]), net.gate(GATE_AND, half, z[i]));
+    }
+  }
+}
+
+/*
+ * Adds width inputs named prefix0, prefix1, ...
+ */
+vector<unsigned int> netlist_inputs(Netlist& net, const string& prefix, unsigned int width) {
+  vector<unsigned int> ret(width);
+  for(unsigned int i = 0; i < width; i++) {
+    stringstream name;
+    name << prefix << i;
+    ret[i] = net.input(name.str());
+  }
+  return ret;
+}
+
+/*
+ * Exposes nets as outputs named prefix0, prefix1, ...
+ */
+void netlist_outputs(Netlist& net, const string& prefix, const vector<unsigned int>& nets) {
+  for(unsigned int i = 0; i < nets.size(); i++) {
+    stringstream name;
+    name << prefix << i;
+    net.output(nets[i], name.str());
+  }
+}
+
+/**
+ * build_netlist()
+ * @param kind [in] which circuit
+ * @param width [in] operand width
+ * @return netlist with inputs a, b (adder), b, q (multipliers) or x (complement)
+ */
+Netlist build_netlist(NetlistKind kind, unsigned int width) {
+  stringstream name;
+  if(kind == NET_ADDER) {
+    name << "kogge_stone_adder_" << width;
+    Netlist net(name.str());
+    vector<unsigned int> a = netlist_inputs(net, "a", width);
+    vector<unsigned int> b = netlist_inputs(net, "b", width);
+    netlist_outputs(net, "s", kogge_stone_gates(net, a, b));
+    return net;
+  }
+
+  if(kind == NET_MULTIPLIER || kind == NET_ARRAY_MULTIPLIER) {
+    name << (kind == NET_MULTIPLIER ? "tree_multiplier_" : "array_multiplier_") << width;
+    Netlist net(name.str());
+    vector<unsigned int> b = netlist_inputs(net, "b", width);
+    vector<unsigned int> q = netlist_inputs(net, "q", width);
+
+    // Summand i is b << i gated by q_i, as in mul()
+    unsigned int product_width = 2 * width - 1;
+    vector<vector<unsigned int> > rows(width, vector<unsigned int>(product_width, net.constant(false)));
+    for(unsigned int i = 0; i < width; i++) {
+      for(unsigned int j = 0; j < width; j++) {
+        rows[i][i + j] = net.gate(GATE_AND, b[j], q[i]);
+      }
+    }
+
+    // Array: fold each summand into a carry-save pair, then resolve it once
+    if(kind == NET_ARRAY_MULTIPLIER && rows.size() > 2) {
+      vector<unsigned int> sum = rows[0], carry = rows[1];
+      for(unsigned int i = 2; i < rows.size(); i++) {
+        vector<unsigned int> next_sum, next_carry;
+        carry_save_gates(net, sum, carry, rows[i], next_sum, next_carry);
+        sum.swap(next_sum);
+        carry.swap(next_carry);
+      }
+      rows.clear();
+      rows.push_back(sum);
+      rows.push_back(carry);
+    }
+
+    // Tree: add neighbouring pairs until one summand is left
+    while(rows.size() > 1) {
+      vector<vector<unsigned int> > next;
+      for(unsigned int i = 0; i + 1 < rows.size(); i += 2) {
+        next.push_back(kogge_stone_gates(net, rows[i], rows[i + 1]));
+      }
+      if(rows.size() % 2) {
+        next.push_back(rows.back());
+      }
+      rows.swap(next);
+    }
+    if(!rows.empty()) {
+      netlist_outputs(net, "p", rows[0]);
+    }
+    return net;
+  }
+
+  name << "complement_" << width;
+  Netlist net(name.str());
+  vector<unsigned int> x = netlist_inputs(net, "x", width);
+
+  // Invert, then add one with a ripple of half adders
+  vector<unsigned int> result(width);
+  unsigned int carry = net.constant(true);
+  for(unsigned int i = 0; i < width; i++) {
+    unsigned int inverted = net.gate(GATE_NOT, x[i]);
+    result[i] = net.gate(GATE_XOR, inverted, carry);
+    carry = net.gate(GATE_AND, inverted, carry);
+  }
+  netlist_outputs(net, "c", result);
+  return net;
+}
+
+/**
+ * critical_transition()
+ * @desc Sets lane 0 of a pair of input vectors to a transition that sends a
+ *       carry through every bit: b = 0 -> 1 with a all 1's (adder), q_0 = 0 -> 1
+ *       with b and the rest of q all 1's (multiplier), x = 1 -> 0 (complement).
+ *       That excites a long path but not necessarily the longest one.
+ * @param kind [in] which circuit
+ * @param width [in] operand width
+ * @param before [in/out] one word per input
+ * @param after [in/out] one word per input
+ */
+void critical_transition(NetlistKind kind, unsigned int width,
+                         vector<word_t>& before, vector<word_t>& after) {
+  for(unsigned int i = 0; i < before.size(); i++) {
+    bool from = false, to = false;
+    if(kind == NET_ADDER) {
+      from = to = i < width;
+      to = to || i == width;
+    }
+    else if(kind == NET_MULTIPLIER || kind == NET_ARRAY_MULTIPLIER) {
+      from = to = i != width;
+      to = true;
+    }
+    else {
+      from = i == 0;
+    }
+    before[i] = (before[i] & ~static_cast<word_t>(1)) | from;
+    after[i] = (after[i] & ~static_cast<word_t>(1)) | to;
+  }
+}
+
+/**
+ * NetlistTiming
+ * @desc Size and delays of one netlist
+ */
+struct NetlistTiming {
+  unsigned int gates;
+  unsigned int depth;           // Longest structural path
+  unsigned int measured;        // Latest output event seen in simulation, at most depth
+};
+
+/**
+ * time_netlist()
+ * @desc Simulates random input transitions, with the critical transition in lane 0
+ * @param net [in] netlist built by build_netlist(kind, width)
+ * @param kind [in] which circuit
+ * @param width [in] operand width
+ * @param rounds [in] number of transitions
+ * @param seed [in] random seed
+ * @return gate count, structural depth and the latest output event, which
+ *         only bounds the critical path from below
+ */
+NetlistTiming time_netlist(const Netlist& net, NetlistKind kind, unsigned int width,
+                           unsigned int rounds = MEASURE_ROUNDS, unsigned long seed = 1) {
+  mt19937_64 rng(seed);
+  unsigned int inputs = net.get_inputs().size();
+  vector<word_t> before(inputs), after(inputs);
+
+  NetlistTiming timing;
+  timing.gates = net.get_gates().size();
+  timing.depth = net.depth();
+  timing.measured = 0;
+
+  for(unsigned int i = 0; i < inputs; i++) {
+    before[i] = rng();
+  }
+  after = before;
+  critical_transition(kind, width, before, after);
+
+  NetlistSimulator sim(net);
+  sim.settle(before);
+  for(unsigned int round = 0; round < rounds; round++) {
+    vector<word_t> next(inputs);
+    for(unsigned int i = 0; i < inputs; i++) {
+      next[i] = rng();
+    }
+
+    // Lane 0 alternates between the two ends of the critical transition
+    vector<word_t> ignored = next;
+    if(round % 2 == 0) {
+      critical_transition(kind, width, ignored, next);
+    }
+    else {
+      critical_transition(kind, width, next, ignored);
+    }
+    timing.measured = max(timing.measured, sim.apply(next));
+  }
+  return timing;
+}
+
+
+/**
+ * ArrayMultiplierCosts
+ * @desc Formula costs for an array multiplier: the partial products, a row
+ *       of full adders per summand after the second (XOR, AND, OR on the
+ *       carry path), and one carry-propagate add of the final pair
+ */
+class ArrayMultiplierCosts : public CostModel {
+  public:
+
+    unsigned int mul_cost(unsigned int size) {
+      if(size < 2) {
+        return 1;
+      }
+      return 1 + 3 * (size - 2) + add_cost(2 * size - 1);
+    }
+
+    string name() const {
+      return "array";
+    }
+};
+
+/**
+ * MeasuredCostModel
+ * @desc Charges the critical path of each width's netlist, built on first
+ *       use: its structural depth. Simulated transitions may miss the
+ *       longest path, so time_netlist()'s latest event is not charged.
+ */
+class MeasuredCostModel : public CostModel {
+  public:
+
+    /**
+     * MeasuredCostModel Constructor
+     * @param multiplier [in] NET_MULTIPLIER or NET_ARRAY_MULTIPLIER
+     */
+    MeasuredCostModel(NetlistKind multiplier = NET_MULTIPLIER) : multiplier_kind(multiplier) {}
+
+    unsigned int add_cost(unsigned int width) {
+      return delay(NET_ADDER, width);
+    }
+
+    unsigned int mul_cost(unsigned int size) {
+      return delay(multiplier_kind, size);
+    }
+
+    unsigned int complement_cost(unsigned int size) {
+      return delay(NET_COMPLEMENT, size);
+    }
+
+    string name() const {
+      return multiplier_kind == NET_MULTIPLIER ? "measured_tree" : "measured_array";
+    }
+
+  private:
+
+    unsigned int delay(NetlistKind kind, unsigned int width) {
+      lock_guard<mutex> guard(lock);
+      pair<NetlistKind, unsigned int> key(kind, width);
+      map<pair<NetlistKind, unsigned int>, unsigned int>::iterator it = delays.find(key);
+      if(it != delays.end()) {
+        return it->second;
+      }
+
+      unsigned int depth = width == 0 ? 0 : build_netlist(kind, width).depth();
+      delays[key] = depth;
+      return depth;
+    }
+
+    NetlistKind multiplier_kind;
+    map<pair<NetlistKind, unsigned int>, unsigned int> delays;
+    mutex lock;                 // Guards delays
+};
+
+#endif
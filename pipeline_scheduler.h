@@ -0,0 +1,360 @@
+#ifndef PIPELINE_SCHEDULER_H
+#define PIPELINE_SCHEDULER_H
+
+#include "binary.h"
+#include "division_algorithms.h"
+#include "sqrt_algorithms.h"
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+
+/**
+ * Unit
+ * @desc Functional units shared between divisions
+ */
+enum Unit {
+  MULTIPLIER,
+  ADDER
+};
+
+/**
+ * PipelineConfig
+ * @desc Describes the shared functional units. Every unit is fully pipelined,
+ *       so each copy accepts one new operation per cycle.
+ */
+struct PipelineConfig {
+  unsigned int mul_stages;      // Cycles before a product is available
+  unsigned int add_stages;      // Cycles before a sum/complement is available
+  unsigned int mul_units;       // Number of multipliers
+  unsigned int add_units;       // Number of adders
+
+  PipelineConfig() : mul_stages(4), add_stages(1), mul_units(1), add_units(1) {}
+};
+
+/**
+ * DivisionRequest
+ * @desc One division in the stream handed to the scheduler
+ */
+struct DivisionRequest {
+  Algorithm algorithm;
+  Binary dividend;
+  Binary divisor;
+  unsigned int arrival;         // Cycle the request enters the divider
+};
+
+/**
+ * Operation
+ * @desc One multiplier or adder operation of a division
+ */
+struct Operation {
+  Unit unit;
+  vector<int> deps;             // Indices of operations that must finish first
+  int issue;                    // Cycle the operation was issued (-1 if not yet)
+  int done;                     // Cycle the result is available
+};
+
+/**
+ * ScheduleReport
+ * @desc Results of scheduling a stream of divisions
+ */
+struct ScheduleReport {
+  unsigned int divisions;
+  unsigned int cycles;          // Cycle the last division completed
+  double throughput;            // Divisions per cycle
+  double mul_occupancy;         // Fraction of multiplier issue slots used over cycles
+  double add_occupancy;         // Fraction of adder issue slots used over cycles
+  unsigned int stalls;          // Cycles ready operations waited on a busy unit
+  unsigned int latency_p50;
+  unsigned int latency_p90;
+  unsigned int latency_p99;
+  unsigned int latency_max;
+};
+
+
+/**
+ * build_operations()
+ * @desc Runs a division or root to find its iteration count, then lays out the
+ *       dependent multiplier/adder operations of those iterations.
+ * @param request [in] the division to break up
+ * @return operations in program order
+ */
+vector<Operation> build_operations(const DivisionRequest& request) {
+  unsigned int cost = 0, iterations = 0;
+  vector<Operation> ops;
+  Operation op;
+  op.issue = -1;
+  op.done = 0;
+
+  if(request.algorithm == MULTIPLICATIVE_DIVISION) {
+    multiplicative_division(request.dividend, request.divisor, cost, &iterations);
+
+    // a_i * f_i and b_i * f_i in parallel, then f_i+1 = complement(b_i+1)
+    int prev_a = -1, prev_b = -1, prev_f = -1;
+    for(unsigned int i = 0; i < iterations; i++) {
+      op.unit = MULTIPLIER;
+      op.deps.clear();
+      if(prev_f >= 0) {
+        op.deps.push_back(prev_a);
+        op.deps.push_back(prev_f);
+      }
+      ops.push_back(op);
+      prev_a = ops.size() - 1;
+
+      op.deps.clear();
+      if(prev_f >= 0) {
+        op.deps.push_back(prev_b);
+        op.deps.push_back(prev_f);
+      }
+      ops.push_back(op);
+      prev_b = ops.size() - 1;
+
+      op.unit = ADDER;
+      op.deps.clear();
+      op.deps.push_back(prev_b);
+      ops.push_back(op);
+      prev_f = ops.size() - 1;
+    }
+  }
+  else if(request.algorithm == GOLDSCHMIDT_SQRT || request.algorithm == GOLDSCHMIDT_RSQRT) {
+    if(request.algorithm == GOLDSCHMIDT_SQRT) {
+      goldschmidt_sqrt(request.divisor, cost, &iterations);
+    }
+    else {
+      goldschmidt_rsqrt(request.divisor, cost, &iterations);
+    }
+
+    // r_i = (3 - b_i) / 2, then b_i * r_i and y_i * r_i, then (b_i * r_i) * r_i
+    int prev_b = -1, prev_y = -1;
+    for(unsigned int i = 0; i < iterations; i++) {
+      op.unit = ADDER;
+      op.deps.clear();
+      if(prev_b >= 0) {
+        op.deps.push_back(prev_b);
+      }
+      ops.push_back(op);
+      int factor = ops.size() - 1;
+
+      op.unit = MULTIPLIER;
+      op.deps.clear();
+      op.deps.push_back(factor);
+      ops.push_back(op);
+      int half_b = ops.size() - 1;
+
+      op.deps.clear();
+      op.deps.push_back(factor);
+      if(prev_y >= 0) {
+        op.deps.push_back(prev_y);
+      }
+      ops.push_back(op);
+      prev_y = ops.size() - 1;
+
+      op.deps.clear();
+      op.deps.push_back(half_b);
+      ops.push_back(op);
+      prev_b = ops.size() - 1;
+    }
+  }
+  else if(request.algorithm == NEWTON_RSQRT) {
+    newton_rsqrt(request.divisor, cost, &iterations);
+
+    // z_i^2, b * z_i^2, the factor, then z_i * factor
+    int prev_z = -1;
+    for(unsigned int i = 0; i < iterations; i++) {
+      op.unit = MULTIPLIER;
+      op.deps.clear();
+      if(prev_z >= 0) {
+        op.deps.push_back(prev_z);
+      }
+      ops.push_back(op);
+
+      op.deps.clear();
+      op.deps.push_back(ops.size() - 1);
+      ops.push_back(op);
+
+      op.unit = ADDER;
+      op.deps.clear();
+      op.deps.push_back(ops.size() - 1);
+      ops.push_back(op);
+
+      op.unit = MULTIPLIER;
+      op.deps.clear();
+      op.deps.push_back(ops.size() - 1);
+      if(prev_z >= 0) {
+        op.deps.push_back(prev_z);
+      }
+      ops.push_back(op);
+      prev_z = ops.size() - 1;
+    }
+  }
+  else {
+    divisor_reciprocation(request.dividend, request.divisor, cost, &iterations);
+
+    // 2 - a_i once, as dr_divisor_step() forms it, then x_i * (2 - a_i) and
+    // a_i * (2 - a_i)
+    int prev_x = -1, prev_a = -1;
+    for(unsigned int i = 0; i < iterations; i++) {
+      op.unit = ADDER;
+      op.deps.clear();
+      if(prev_a >= 0) {
+        op.deps.push_back(prev_a);
+      }
+      ops.push_back(op);
+      int factor = ops.size() - 1;
+
+      op.unit = MULTIPLIER;
+      op.deps.clear();
+      op.deps.push_back(factor);
+      if(prev_x >= 0) {
+        op.deps.push_back(prev_x);
+      }
+      ops.push_back(op);
+      prev_x = ops.size() - 1;
+
+      op.deps.clear();
+      op.deps.push_back(factor);
+      if(prev_a >= 0) {
+        op.deps.push_back(prev_a);
+      }
+      ops.push_back(op);
+      prev_a = ops.size() - 1;
+    }
+  }
+
+  return ops;
+}
+
+/**
+ * percentile()
+ * @param sorted [in] sorted samples
+ * @param pct [in] percentile between 0 and 100
+ * @return nearest-rank percentile of the samples
+ */
+unsigned int percentile(const vector<unsigned int>& sorted, unsigned int pct) {
+  if(sorted.empty()) {
+    return 0;
+  }
+  unsigned int rank = (pct * sorted.size() + 99) / 100;
+  return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+/**
+ * schedule_divisions()
+ * @desc Cycle-level list scheduler. Every cycle, ready operations are issued
+ *       oldest request first until the units run out of issue slots, so
+ *       iterations of independent divisions fill each other's bubbles.
+ * @param requests [in] stream of divisions
+ * @param config [in] functional unit description
+ * @return throughput, occupancy and latency statistics
+ */
+ScheduleReport schedule_divisions(const vector<DivisionRequest>& requests,
+                                  const PipelineConfig& config) {
+  vector<vector<Operation> > ops(requests.size());
+  vector<unsigned int> remaining(requests.size());
+  vector<unsigned int> finish(requests.size(), 0);
+  unsigned int pending = 0;
+
+  for(unsigned int r = 0; r < requests.size(); r++) {
+    ops[r] = build_operations(requests[r]);
+    remaining[r] = ops[r].size();
+    finish[r] = requests[r].arrival;
+    pending += remaining[r];
+  }
+
+  // Oldest request first
+  vector<unsigned int> order(requests.size());
+  for(unsigned int r = 0; r < order.size(); r++) {
+    order[r] = r;
+  }
+  for(unsigned int i = 1; i < order.size(); i++) {
+    for(unsigned int j = i; j > 0 && requests[order[j]].arrival < requests[order[j - 1]].arrival; j--) {
+      swap(order[j], order[j - 1]);
+    }
+  }
+
+  ScheduleReport report;
+  unsigned int mul_issued = 0, add_issued = 0;
+  report.stalls = 0;
+
+  unsigned int cycle = 0;
+  for(; pending > 0; cycle++) {
+    unsigned int mul_free = config.mul_units;
+    unsigned int add_free = config.add_units;
+
+    for(unsigned int k = 0; k < order.size(); k++) {
+      unsigned int r = order[k];
+      if(requests[r].arrival > cycle || remaining[r] == 0) {
+        continue;
+      }
+
+      for(unsigned int i = 0; i < ops[r].size(); i++) {
+        Operation& op = ops[r][i];
+        if(op.issue >= 0) {
+          continue;
+        }
+
+        bool ready = true;
+        for(unsigned int d = 0; d < op.deps.size() && ready; d++) {
+          const Operation& dep = ops[r][op.deps[d]];
+          ready = dep.issue >= 0 && dep.done <= static_cast<int>(cycle);
+        }
+        if(!ready) {
+          continue;
+        }
+
+        unsigned int& free_slots = (op.unit == MULTIPLIER) ? mul_free : add_free;
+        if(free_slots == 0) {
+          report.stalls++;
+          continue;
+        }
+
+        free_slots--;
+        op.issue = cycle;
+        op.done = cycle + (op.unit == MULTIPLIER ? config.mul_stages : config.add_stages);
+        finish[r] = max(finish[r], static_cast<unsigned int>(op.done));
+        remaining[r]--;
+        pending--;
+      }
+    }
+
+    mul_issued += config.mul_units - mul_free;
+    add_issued += config.add_units - add_free;
+  }
+
+  vector<unsigned int> latencies(requests.size());
+  unsigned int last = 0;
+  for(unsigned int r = 0; r < requests.size(); r++) {
+    latencies[r] = finish[r] - requests[r].arrival;
+    last = max(last, finish[r]);
+  }
+  sort(latencies.begin(), latencies.end());
+
+  report.divisions = requests.size();
+  report.cycles = last;
+  // Both rates are over the whole schedule, up to the last completion
+  report.throughput = last > 0 ? static_cast<double>(requests.size()) / last : 0;
+  report.mul_occupancy = last > 0 ? static_cast<double>(mul_issued) / (last * config.mul_units) : 0;
+  report.add_occupancy = last > 0 ? static_cast<double>(add_issued) / (last * config.add_units) : 0;
+  report.latency_p50 = percentile(latencies, 50);
+  report.latency_p90 = percentile(latencies, 90);
+  report.latency_p99 = percentile(latencies, 99);
+  report.latency_max = latencies.empty() ? 0 : latencies.back();
+
+  return report;
+}
+
+/*
+ * ostream insertion operator for the schedule report
+ */
+ostream& operator <<(ostream &os, const ScheduleReport &report) {
+  return os << "Divisions: " << report.divisions << "  Cycles: " << report.cycles
+            << "  Throughput: " << report.throughput << " div/cycle" << endl
+            << "Multiplier occupancy: " << report.mul_occupancy
+            << "  Adder occupancy: " << report.add_occupancy
+            << "  Stalls: " << report.stalls << endl
+            << "Latency p50: " << report.latency_p50 << "  p90: " << report.latency_p90
+            << "  p99: " << report.latency_p99 << "  max: " << report.latency_max;
+}
+
+#endif
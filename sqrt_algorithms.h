@@ -0,0 +1,209 @@
+#ifndef SQRT_ALGORITHMS_H
+#define SQRT_ALGORITHMS_H
+
+#include "binary.h"
+#include "division_algorithms.h"
+#include <iostream>
+
+using namespace std;
+
+static const int ROOT_ITERLIMIT = 8;
+
+
+/**
+ * Normalizes b into [0.25, 1) by shifting an even number of places
+ * @param b [in/out] Operand to normalize, a fraction with one integer bit
+ * @return k such that the original b is b * 4^-k
+ */
+int normalize_root_operand(Binary& b) {
+  double bVal = b.toDouble();
+  int k = 0;
+  while(bVal < 0.25)
+  {
+    b = b << 2;
+    bVal *= 4;
+    k++;
+  }
+  return k;
+}
+
+
+/**
+ * Forms the Newton/Goldschmidt root factor (3 - t) / 2 for t in (0, 2)
+ * @desc 2 - t/2 is the 2's complement of t/2 and lies in (1, 2), so
+ *       subtracting 0.5 only touches the top two bits.
+ * @param t [in] Value converging to 1, a fraction with one integer bit
+ * @param cost [in/out] Cost to perform operation
+ * @return Binary value with the factor
+ */
+Binary root_factor(const Binary& t, unsigned int& cost) {
+  int size = t.get_size();
+  Binary r = t;
+  r = r >> 1;
+  r.set_digit(size - 1, 0);
+  r.complement(cost);
+
+  bool half = r.get_digit(size - 2);
+  r.set_digit(size - 1, half);
+  r.set_digit(size - 2, !half);
+  return r;
+}
+
+
+/**
+ * Goldschmidt iteration shared by goldschmidt_sqrt and goldschmidt_rsqrt
+ * @desc b_i+1 = b_i * r_i^2 and y_i+1 = y_i * r_i with r_i = (3 - b_i) / 2.
+ *       b_i goes to 1, so y_i goes to y_0 / sqrt(b_0). Truncation can leave
+ *       b_i stuck just below one, so the loop also stops once b_i stops
+ *       changing.
+ * @param b [in] Operand in [0.25, 1)
+ * @param y [in] Initial value of y
+ * @param cost [in/out] Cost to perform operation
+ * @param iterations [out] If not NULL, number of iterations performed
+ * @return final y
+ */
+Binary goldschmidt_root(const Binary& b, const Binary& y, unsigned int& cost,
+                        unsigned int* iterations) {
+  int size = b.get_size();
+  const Binary& one = constant_pool().get(CONST_NEAR_ONE, size, size-1);
+
+  Binary b_i = b;
+  Binary y_i = y;
+
+  unsigned int cost_b_i, cost_y_i;
+  int i;
+  for(i = 0; i < ROOT_ITERLIMIT && b_i != one; i++) {
+    Binary r_i = root_factor(b_i, cost);
+
+    cost_b_i = 0;
+    cost_y_i = 0;
+
+    // b_i * r_i and y_i * r_i in parallel, then the second factor of r_i^2
+    Binary b_next = mul(b_i, r_i, cost_b_i).truncate_to_size(size);
+    b_next = mul(b_next, r_i, cost_b_i).truncate_to_size(size);
+    y_i = mul(y_i, r_i, cost_y_i).truncate_to_size(size);
+
+    cost += max(cost_b_i, cost_y_i);
+
+    if(b_next == b_i) {
+      i++;
+      break;
+    }
+    b_i = b_next;
+  }
+  if(iterations != NULL) {
+    *iterations = i;
+  }
+
+  return y_i;
+}
+
+
+/**
+ * Performs sqrt(b) = ? using Goldschmidt's method
+ * @param b [in] Operand, a fraction with one integer bit
+ * @param cost [in/out] Cost to perform operation
+ * @param iterations [out] If not NULL, number of iterations performed
+ * @return Binary value with the result
+ */
+Binary goldschmidt_sqrt(const Binary& bP, unsigned int& cost,
+                        unsigned int* iterations = NULL) {
+  Binary b = bP;
+  if(b.toDouble() == 0) {
+    if(iterations != NULL) {
+      *iterations = 0;
+    }
+    return b;
+  }
+
+  int k = normalize_root_operand(b);
+
+  // y_0 = b gives y_i -> b / sqrt(b)
+  Binary result = goldschmidt_root(b, b, cost, iterations);
+
+  // sqrt(b * 4^-k) = sqrt(b) * 2^-k: move the decimal, widening with
+  // leading 0's so it stays inside the number and no low bits are lost
+  Binary scaled(result.get_size() + k);
+  for(unsigned int i = 0; i < scaled.get_size(); i++) {
+    scaled.set_digit(i, result.get_digit(i));
+  }
+  scaled.set_decimal(result.get_decimal() + k);
+  return scaled;
+}
+
+
+/**
+ * Performs 1/sqrt(b) = ? using Goldschmidt's method
+ * @param b [in] Operand, a fraction with one integer bit
+ * @param cost [in/out] Cost to perform operation
+ * @param iterations [out] If not NULL, number of iterations performed
+ * @return Binary value with the result
+ */
+Binary goldschmidt_rsqrt(const Binary& bP, unsigned int& cost,
+                         unsigned int* iterations = NULL) {
+  Binary b = bP;
+  if(b.toDouble() == 0) {
+    throw "rsqrt of zero";
+  }
+
+  int k = normalize_root_operand(b);
+
+  // 1/sqrt(b) is in (1, 2], so iterate on half of it: y_0 = 0.5
+  int size = b.get_size();
+  const Binary& half = constant_pool().get(CONST_HALF, size, size-1);
+
+  Binary result = goldschmidt_root(b, half, cost, iterations);
+
+  // Undo the halving, then 1/sqrt(b * 4^-k) = 2^k / sqrt(b)
+  result.decimal -= 1 + k;
+  return result;
+}
+
+
+/**
+ * Performs 1/sqrt(b) = ? using Newton-Raphson iteration
+ * @desc x_i+1 = x_i * (3 - b * x_i^2) / 2, starting from x_0 = 1. The
+ *       iterate is kept as z_i = x_i / 2 so that it stays below 1.
+ * @param b [in] Operand, a fraction with one integer bit
+ * @param cost [in/out] Cost to perform operation
+ * @param iterations [out] If not NULL, number of iterations performed
+ * @return Binary value with the result
+ */
+Binary newton_rsqrt(const Binary& bP, unsigned int& cost,
+                    unsigned int* iterations = NULL) {
+  Binary b = bP;
+  if(b.toDouble() == 0) {
+    throw "rsqrt of zero";
+  }
+
+  int k = normalize_root_operand(b);
+
+  int size = b.get_size();
+  Binary z_i = constant_pool().get(CONST_HALF, size, size-1);
+
+  unsigned int count = 0;
+  for(int i = 0; i < ROOT_ITERLIMIT; i++) {
+    // b * x_i^2 = 4 * b * z_i^2
+    Binary w = mul(z_i, z_i, cost).truncate_to_size(size);
+    w = mul(b, w, cost).truncate_to_size(size);
+    w = w << 2;
+
+    Binary r_i = root_factor(w, cost);
+    Binary z_next = mul(z_i, r_i, cost).truncate_to_size(size);
+    count++;
+
+    if(z_next == z_i) {
+      break;
+    }
+    z_i = z_next;
+  }
+  if(iterations != NULL) {
+    *iterations = count;
+  }
+
+  // x = 2 * z, then 1/sqrt(b * 4^-k) = 2^k / sqrt(b)
+  z_i.decimal -= 1 + k;
+  return z_i;
+}
+
+#endif
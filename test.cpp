@@ -1,13 +1,23 @@
 #include "binary.h"
 #include "division_algorithms.h"
+#include "pipeline_scheduler.h"
+#include "sqrt_algorithms.h"
+#include "ieee754.h"
+#include "division_server.h"
+#include "netlist.h"
+#include "autotuner.h"
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <cstdlib>
 
 using namespace std;
 
 const bool DELIMITED = false;
 const char DELIM = ';';
+const bool SCHEDULE = true;
+const unsigned int CACHE_SIZE = 256;
+const unsigned int TIMING_REPEATS = 200;
 
 string DIVIDENDS[8] = {
   "0.11011110", // .DE
@@ -60,42 +70,379 @@ string doubleAsBinary(double num)
   return os.str();
 }
 
-int main() {
-  
+/*
+ * Check mul() on a pool, set with set_mul_pool() from the driver thread and
+ * from inside one of the pool's own tasks, against the serial path on random
+ * operands of 200 to 900 bits
+ */
+int check_parallel_mul_main(unsigned int count, unsigned int threads) {
+  ThreadPool pool(threads);
+  mt19937_64 rng(1);
+  unsigned int mismatches = 0;
+
+  for(unsigned int n = 0; n < count; n++) {
+    Binary x(200 + rng() % 701), y(200 + rng() % 701);
+    for(unsigned int i = 0; i < x.get_size(); i++) {
+      x.set_digit(i, rng() & 1);
+    }
+    for(unsigned int i = 0; i < y.get_size(); i++) {
+      y.set_digit(i, rng() & 1);
+    }
+    x.set_decimal(x.get_size() - 1);
+    y.set_decimal(y.get_size() - 1);
+
+    unsigned int serial_cost = 0, pooled_cost = 0, nested_cost = 0;
+    Binary serial = mul(x, y, serial_cost);
+
+    set_mul_pool(&pool);
+    Binary pooled = mul(x, y, pooled_cost);
+    set_mul_pool(NULL);
+
+    // A task calling mul() on its own pool must not wait on the other workers
+    Binary nested;
+    pool.parallel_for(0, 1, [&](unsigned int lo, unsigned int hi) {
+      set_mul_pool(&pool);
+      nested = mul(x, y, nested_cost);
+      set_mul_pool(NULL);
+    });
+
+    if(pooled != serial || nested != serial || pooled_cost != serial_cost || nested_cost != serial_cost) {
+      cout << "Mismatch at " << x.get_size() << " x " << y.get_size() << " bits" << endl;
+      mismatches++;
+    }
+  }
+
+  cout << count << " multiplications on " << pool.get_size() << " threads, "
+       << mismatches << " mismatches" << endl;
+  return mismatches == 0 ? 0 : 1;
+}
+
+/*
+ * Check the IEEE front-end against hardware division for every format,
+ * algorithm and rounding mode
+ */
+int ieee_verify_main(unsigned long count, unsigned int threads) {
+  const char* MODES[] = {"nearest-even", "toward-zero", "upward", "downward"};
+  const char* ALGORITHMS[] = {"MD", "DR"};
+  const IEEEFormat* FORMATS[] = {&BINARY32, &BINARY64};
+  const char* FORMAT_NAMES[] = {"binary32", "binary64"};
+
+  ThreadPool pool(threads);
+  unsigned long mismatches = 0;
+
+  for(int f = 0; f < 2; f++) {
+    for(int alg = 0; alg < 2; alg++) {
+      for(int mode = 0; mode < 4; mode++) {
+        IEEEVerifyReport report = ieee_verify(count, *FORMATS[f], static_cast<Algorithm>(alg),
+                                              static_cast<RoundingMode>(mode), pool);
+        cout << FORMAT_NAMES[f] << " " << ALGORITHMS[alg] << " " << MODES[mode] << ": "
+             << report << endl;
+        mismatches += report.mismatches;
+      }
+    }
+  }
+
+  return mismatches == 0 ? 0 : 1;
+}
+
+/*
+ * Write the netlist behind add(), mul() or complement() and compare its
+ * simulated delay with the formula
+ */
+int netlist_main(const string& kind_name, unsigned int width) {
+  NetlistKind kind;
+  unsigned int formula;
+  if(kind_name == "adder") {
+    kind = NET_ADDER;
+    formula = formula_costs().add_cost(width);
+  }
+  else if(kind_name == "multiplier") {
+    kind = NET_MULTIPLIER;
+    formula = formula_costs().mul_cost(width);
+  }
+  else if(kind_name == "array-multiplier") {
+    kind = NET_ARRAY_MULTIPLIER;
+    formula = ArrayMultiplierCosts().mul_cost(width);
+  }
+  else if(kind_name == "complement") {
+    kind = NET_COMPLEMENT;
+    formula = formula_costs().complement_cost(width);
+  }
+  else {
+    cerr << "unknown netlist " << kind_name << " (adder, multiplier, array-multiplier or complement)" << endl;
+    return 1;
+  }
+
+  Netlist net = build_netlist(kind, width);
+  NetlistTiming timing = time_netlist(net, kind, width);
+  cout << net
+       << "# gates: " << timing.gates << "  depth: " << timing.depth
+       << "  measured: " << timing.measured << "  formula: " << formula << endl;
+  return 0;
+}
+
+/*
+ * Search the divider design space and print the latency vs accuracy
+ * frontier for each cost source
+ */
+int autotune_main(const string& cache_path, unsigned int samples, unsigned int threads) {
+  constant_pool().prefill(POOL_TABLE_WIDTH - 1);
+  TuneSpace space = default_tune_space();
+  TuneCache cache(cache_path);
+  ThreadPool pool(threads);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  unsigned int computed = 0;
+  vector<TuneResult> results = autotune(space, samples, 1, cache, pool, &computed);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  cout << results.size() << " configurations, " << results.size() - computed << " cached, "
+       << computed << " run in " << seconds << " s" << endl;
+
+  for(unsigned int c = 0; c < space.sources.size(); c++) {
+    vector<TuneResult> subset;
+    for(unsigned int i = 0; i < results.size(); i++) {
+      if(results[i].config.source == space.sources[c]) {
+        subset.push_back(results[i]);
+      }
+    }
+
+    vector<TuneResult> frontier = pareto_frontier(subset);
+    cout << endl << "Pareto frontier (" << (space.sources[c] == COST_FORMULA ? "formula" : "measured")
+         << " costs):" << endl;
+    for(unsigned int i = 0; i < frontier.size(); i++) {
+      cout << frontier[i] << endl;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Serve divisions on a Unix domain socket until a client asks it to stop
+ */
+int serve_main(const string& path, unsigned int workers) {
+  constant_pool().prefill(POOL_TABLE_WIDTH - 1);
+  DivisionServer server(path, workers);
+  server.run();
+  cout << server.stats() << endl;
+  return 0;
+}
+
+/*
+ * Pipeline every table division through the server rounds times, then print
+ * the first round, the client-side latency and the server's statistics
+ */
+int client_main(const string& path, unsigned int rounds, bool stop) {
+  DivisionClient client(path);
+  const char* ALGORITHMS[] = {"md", "dr"};
+  unsigned int pairs = sizeof(DIVIDENDS) / sizeof(DIVIDENDS[0]);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  unsigned int sent = 0;
+  for(unsigned int round = 0; round < rounds; round++) {
+    for(unsigned int i = 0; i < pairs; i++) {
+      for(int alg = 0; alg < 2; alg++) {
+        stringstream request;
+        request << sent++ << " " << ALGORITHMS[alg] << " 0 " << DIVIDENDS[i] << " " << DIVISORS[i];
+        client.send(request.str());
+      }
+    }
+  }
+
+  vector<string> first;
+  for(unsigned int i = 0; i < sent; i++) {
+    string response = client.receive();
+    stringstream fields(response);
+    unsigned int id;
+    fields >> id;
+    if(id < 2 * pairs) {
+      first.push_back(response);
+    }
+  }
+  double elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+  sort(first.begin(), first.end(), [](const string& x, const string& y) {
+    return atoi(x.c_str()) < atoi(y.c_str());
+  });
+  for(unsigned int i = 0; i < first.size(); i++) {
+    cout << first[i] << endl;
+  }
+  cout << "Sent " << sent << " requests in " << elapsed << " us ("
+       << elapsed / sent << " us per request)" << endl
+       << client.request("stats") << endl;
+
+  if(stop) {
+    client.request("shutdown");
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && string(argv[1]) == "--ieee-verify") {
+    unsigned long count = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+    unsigned int threads = argc > 3 ? strtoul(argv[3], NULL, 10) : thread::hardware_concurrency();
+    return ieee_verify_main(count, threads);
+  }
+  if (argc > 1 && string(argv[1]) == "--check-parallel-mul") {
+    unsigned int count = argc > 2 ? strtoul(argv[2], NULL, 10) : 200;
+    unsigned int threads = argc > 3 ? strtoul(argv[3], NULL, 10) : thread::hardware_concurrency();
+    return check_parallel_mul_main(count, threads);
+  }
+  if (argc > 3 && string(argv[1]) == "--netlist") {
+    return netlist_main(argv[2], strtoul(argv[3], NULL, 10));
+  }
+  if (argc > 1 && string(argv[1]) == "--autotune") {
+    string cache_path = argc > 2 ? argv[2] : "autotune.cache";
+    unsigned int samples = argc > 3 ? strtoul(argv[3], NULL, 10) : TUNE_SAMPLES;
+    unsigned int threads = argc > 4 ? strtoul(argv[4], NULL, 10) : thread::hardware_concurrency();
+    return autotune_main(cache_path, samples, threads);
+  }
+  if (argc > 2 && string(argv[1]) == "--serve") {
+    unsigned int workers = argc > 3 ? strtoul(argv[3], NULL, 10) : thread::hardware_concurrency();
+    return serve_main(argv[2], workers);
+  }
+  if (argc > 2 && (string(argv[1]) == "--client" || string(argv[1]) == "--client-stop")) {
+    unsigned int rounds = argc > 3 ? strtoul(argv[3], NULL, 10) : 1;
+    return client_main(argv[2], rounds, string(argv[1]) == "--client-stop");
+  }
+
+  constant_pool().prefill(POOL_TABLE_WIDTH - 1);
+
   cout << "Dividend" << DELIM << "Divisor" << DELIM
-       << "Multiplicative Division Quotient" << DELIM << "Cost" << DELIM 
-       << "Divisor Reciprocation Quotient" << DELIM << "Cost" << DELIM
-       << "Correct Value" << endl;
+       << "Multiplicative Division Quotient" << DELIM << "Cost" << DELIM << "Measured" << DELIM
+       << "Carry-Save MD Quotient" << DELIM << "Cost" << DELIM
+       << "Divisor Reciprocation Quotient" << DELIM << "Cost" << DELIM << "Measured" << DELIM
+       << "Correct Value" << DELIM
+       << "Goldschmidt Divisor Sqrt" << DELIM << "Cost" << DELIM
+       << "Goldschmidt Divisor RSqrt" << DELIM << "Cost" << DELIM
+       << "Newton Divisor RSqrt" << DELIM << "Cost" << DELIM
+       << "Correct Sqrt" << DELIM << "Correct RSqrt" << endl;
+
+  vector<DivisionRequest> stream;
+  DivisionCache cache(CACHE_SIZE);
+  MeasuredCostModel measured;
 
   for(int i = 0; i < sizeof(DIVIDENDS) / sizeof(DIVIDENDS[0]); i++) {
     Binary dividend(DIVIDENDS[i].size()-1);
     Binary divisor(DIVISORS[i].size()-1);
     Binary md_result;
+    Binary cs_result;
     Binary dr_result;
+    Binary gs_sqrt, gs_rsqrt, nr_rsqrt;
 
     unsigned int md_cost = 0;
     unsigned int dr_cost = 0;
+    unsigned int md_measured = 0;
+    unsigned int dr_measured = 0;
+    unsigned int cs_cost = 0;
+    unsigned int cs_iterations = 0;
+    unsigned int md_iterations = 0;
+    unsigned int dr_iterations = 0;
+    unsigned int gs_sqrt_cost = 0, gs_rsqrt_cost = 0, nr_rsqrt_cost = 0;
 
     dividend = DIVIDENDS[i].c_str();
     divisor = DIVISORS[i].c_str();
 
-    md_result = multiplicative_division(dividend, divisor, md_cost);
-    dr_result = divisor_reciprocation(dividend, divisor, dr_cost);
+    md_result = multiplicative_division(dividend, divisor, md_cost, &md_iterations, &cache);
+    dr_result = divisor_reciprocation(dividend, divisor, dr_cost, &dr_iterations, &cache);
+    cs_result = carry_save_division(dividend, divisor, cs_cost, &cs_iterations);
+
+    // Same divisions charged with simulated netlist delays
+    set_cost_model(&measured);
+    multiplicative_division(dividend, divisor, md_measured, NULL, &cache);
+    divisor_reciprocation(dividend, divisor, dr_measured, NULL, &cache);
+    set_cost_model(NULL);
+
+    gs_sqrt = goldschmidt_sqrt(divisor, gs_sqrt_cost);
+    gs_rsqrt = goldschmidt_rsqrt(divisor, gs_rsqrt_cost);
+    nr_rsqrt = newton_rsqrt(divisor, nr_rsqrt_cost);
     if (DELIMITED){
       cout << dividend << DELIM << divisor << DELIM 
-           << md_result << DELIM << md_cost << DELIM
-           << dr_result << DELIM << dr_cost << DELIM 
-           << doubleAsBinary(dividend.toDouble() / divisor.toDouble())
+           << md_result << DELIM << md_cost << DELIM << md_measured << DELIM
+           << cs_result << DELIM << cs_cost << DELIM
+           << dr_result << DELIM << dr_cost << DELIM << dr_measured << DELIM 
+           << doubleAsBinary(dividend.toDouble() / divisor.toDouble()) << DELIM
+           << gs_sqrt << DELIM << gs_sqrt_cost << DELIM
+           << gs_rsqrt << DELIM << gs_rsqrt_cost << DELIM
+           << nr_rsqrt << DELIM << nr_rsqrt_cost << DELIM
+           << doubleAsBinary(sqrt(divisor.toDouble())) << DELIM
+           << doubleAsBinary(1 / sqrt(divisor.toDouble()))
            << endl;
     } else {
       cout << "Dividend: " << dividend << endl
            << "Divisor: " << divisor << endl
-           << "MD Quotient: " << md_result << "  Cost: " << md_cost << endl
-           << "DR Quotient: " << dr_result << "  Cost: " << dr_cost << endl
+           << "MD Quotient: " << md_result << "  Cost: " << md_cost
+           << "  Measured: " << md_measured << "  Iterations: " << md_iterations << endl
+           << "CS Quotient: " << cs_result << "  Cost: " << cs_cost
+           << "  Iterations: " << cs_iterations << endl
+           << "DR Quotient: " << dr_result << "  Cost: " << dr_cost
+           << "  Measured: " << dr_measured << "  Iterations: " << dr_iterations << endl
            << "Actual Value: " << doubleAsBinary(dividend.toDouble() / divisor.toDouble())
+           << endl
+           << "GS Divisor Sqrt: " << gs_sqrt << "  Cost: " << gs_sqrt_cost << endl
+           << "GS Divisor RSqrt: " << gs_rsqrt << "  Cost: " << gs_rsqrt_cost << endl
+           << "NR Divisor RSqrt: " << nr_rsqrt << "  Cost: " << nr_rsqrt_cost << endl
+           << "Actual Sqrt: " << doubleAsBinary(sqrt(divisor.toDouble())) << endl
+           << "Actual RSqrt: " << doubleAsBinary(1 / sqrt(divisor.toDouble()))
            << endl << endl;
     }
 
+    DivisionRequest request;
+    request.dividend = dividend;
+    request.divisor = divisor;
+    request.arrival = 0;
+    request.algorithm = MULTIPLICATIVE_DIVISION;
+    stream.push_back(request);
+    request.algorithm = DIVISOR_RECIPROCATION;
+    stream.push_back(request);
+    request.algorithm = GOLDSCHMIDT_SQRT;
+    stream.push_back(request);
+    request.algorithm = GOLDSCHMIDT_RSQRT;
+    stream.push_back(request);
+    request.algorithm = NEWTON_RSQRT;
+    stream.push_back(request);
+  }
+
+  // Wall time of the simulation itself, resolved vs carry-save iterates
+  double md_seconds = 0, cs_seconds = 0;
+  unsigned int md_total = 0, cs_total = 0;
+  for(int i = 0; i < sizeof(DIVIDENDS) / sizeof(DIVIDENDS[0]); i++) {
+    Binary dividend(DIVIDENDS[i].size()-1);
+    Binary divisor(DIVISORS[i].size()-1);
+    dividend = DIVIDENDS[i].c_str();
+    divisor = DIVISORS[i].c_str();
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(unsigned int r = 0; r < TIMING_REPEATS; r++) {
+      unsigned int cost = 0;
+      multiplicative_division(dividend, divisor, cost);
+      md_total += r == 0 ? cost : 0;
+    }
+    chrono::steady_clock::time_point middle = chrono::steady_clock::now();
+    for(unsigned int r = 0; r < TIMING_REPEATS; r++) {
+      unsigned int cost = 0;
+      carry_save_division(dividend, divisor, cost);
+      cs_total += r == 0 ? cost : 0;
+    }
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+    md_seconds += chrono::duration<double>(middle - start).count();
+    cs_seconds += chrono::duration<double>(end - middle).count();
+  }
+  cout << "Resolved MD: total cost " << md_total << ", "
+       << md_seconds * 1e6 / TIMING_REPEATS << " us per table" << endl
+       << "Carry-save MD: total cost " << cs_total << ", "
+       << cs_seconds * 1e6 / TIMING_REPEATS << " us per table" << endl;
+
+  cout << "Divisor cache hits: " << cache.hits()
+       << "  misses: " << cache.misses() << endl;
+
+  if (SCHEDULE) {
+    // Back-to-back divisions and roots sharing one pipelined multiplier and adder
+    PipelineConfig config;
+    cout << "Pipelined schedule (" << config.mul_stages << "-stage multiplier, "
+         << config.add_stages << "-stage adder):" << endl
+         << schedule_divisions(stream, config) << endl;
   }
 
   return 0;
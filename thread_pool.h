@@ -0,0 +1,161 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+
+/**
+ * ThreadPool
+ * @desc Fixed set of worker threads pulling tasks off a shared queue.
+ *       Tasks must not wait on other tasks of the same pool, except through
+ *       parallel_for(), which runs serially when called from one.
+ */
+class ThreadPool {
+  public:
+
+    /**
+     * ThreadPool Constructor
+     * @param threads [in] number of worker threads (at least one is started)
+     */
+    ThreadPool(unsigned int threads) {
+      stopping = false;
+      if(threads == 0) {
+        threads = 1;
+      }
+      for(unsigned int i = 0; i < threads; i++) {
+        workers.push_back(thread(&ThreadPool::work, this));
+      }
+    }
+
+    /**
+     * ThreadPool Destructor
+     * @desc Finishes the queued tasks and joins the workers
+     */
+    ~ThreadPool() {
+      {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+      }
+      wake.notify_all();
+      for(unsigned int i = 0; i < workers.size(); i++) {
+        workers[i].join();
+      }
+    }
+
+    /**
+     * get_size()
+     * @return number of worker threads
+     */
+    unsigned int get_size() const {
+      return workers.size();
+    }
+
+    /**
+     * submit()
+     * @desc Queues a task to run on one of the workers
+     * @param task [in] the task to run
+     */
+    void submit(const function<void()>& task) {
+      {
+        lock_guard<mutex> guard(lock);
+        tasks.push_back(task);
+      }
+      wake.notify_one();
+    }
+
+    /**
+     * parallel_for()
+     * @desc Splits [begin, end) into one contiguous chunk per worker and
+     *       blocks until every chunk has run. Called from one of this pool's
+     *       own tasks, it runs body over the whole range on the calling
+     *       thread instead: the chunks could otherwise wait behind tasks
+     *       that are themselves waiting on them.
+     * @param begin [in] first index
+     * @param end [in] one past the last index
+     * @param body [in] called with the bounds of each chunk
+     */
+    void parallel_for(unsigned int begin, unsigned int end,
+                      const function<void(unsigned int, unsigned int)>& body) {
+      if(end <= begin) {
+        return;
+      }
+      if(current_pool() == this) {
+        body(begin, end);
+        return;
+      }
+
+      unsigned int chunks = min(static_cast<unsigned int>(workers.size()), end - begin);
+      unsigned int step = (end - begin + chunks - 1) / chunks;
+
+      mutex done_lock;
+      condition_variable done;
+      unsigned int remaining = 0;
+
+      for(unsigned int lo = begin; lo < end; lo += step) {
+        remaining++;
+      }
+
+      for(unsigned int lo = begin; lo < end; lo += step) {
+        unsigned int hi = min(lo + step, end);
+        submit([&, lo, hi]() {
+          body(lo, hi);
+          lock_guard<mutex> guard(done_lock);
+          if(--remaining == 0) {
+            done.notify_one();
+          }
+        });
+      }
+
+      unique_lock<mutex> guard(done_lock);
+      while(remaining > 0) {
+        done.wait(guard);
+      }
+    }
+
+  private:
+
+    /*
+     * Pool the calling thread works for, or NULL
+     */
+    static ThreadPool*& current_pool() {
+      static thread_local ThreadPool* pool = NULL;
+      return pool;
+    }
+
+    /*
+     * Worker loop: run tasks until the pool is stopped and drained
+     */
+    void work() {
+      current_pool() = this;
+      while(true) {
+        function<void()> task;
+        {
+          unique_lock<mutex> guard(lock);
+          while(!stopping && tasks.empty()) {
+            wake.wait(guard);
+          }
+          if(tasks.empty()) {
+            return;
+          }
+          task = tasks.front();
+          tasks.pop_front();
+        }
+        task();
+      }
+    }
+
+    vector<thread> workers;
+    deque<function<void()> > tasks;
+    mutex lock;
+    condition_variable wake;
+    bool stopping;              // Set once the destructor runs
+};
+
+#endif